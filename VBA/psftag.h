@@ -15,6 +15,8 @@ void *psftag_create(void);
 void  psftag_delete(void *psftag);
 
 int psftag_readfromfile(void *psftag, const char *path);
+// Same, from a whole file already in memory
+int psftag_readfrommemory(void *psftag, const void *data, int size);
 int psftag_writetofile(void *psftag, const char *path);
 const char *psftag_getlasterror(void *psftag);
 
@@ -50,6 +52,34 @@ int psftag_raw_getvar(const char *tag, const char *variable, char *value_out, in
 //
 void psftag_raw_setvar(char *tag, int tag_max_size, const char *variable, const char *value);
 
+//
+// A tag parsed once into a table of its variables, for when more than one
+// is wanted. Variables are found as psftag_raw_getvar finds them: names are
+// case-insensitive and a variable on several lines is joined with newlines.
+//
+#define PSFTAG_TABLE_VARS 128
+
+struct psftag_table {
+  int count;
+  struct {
+    int name;   // offsets into strings
+    int value;
+  } vars[PSFTAG_TABLE_VARS];
+  char strings[50002];
+};
+
+void psftag_parse(struct psftag_table *table, const char *tag);
+
+//
+// Returns the value of the variable, or NULL if the tag doesn't have it
+//
+const char *psftag_table_find(const struct psftag_table *table, const char *variable);
+
+//
+// Same as psftag_getvar
+//
+int psftag_table_getvar(const struct psftag_table *table, const char *variable, char *value_out, int value_out_size);
+
 #ifdef __cplusplus
 }
 #endif
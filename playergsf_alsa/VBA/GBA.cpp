@@ -29,6 +29,7 @@
 //#include "EEprom.h"
 //#include "Flash.h"
 #include "Sound.h"
+#include "snd_interp.h"
 //#include "Sram.h"
 #include "bios.h"
 #include "unzip.h"
@@ -370,7 +371,7 @@ u32 myROM[] = {
 0x03007FE0
 };
 
-/*variable_desc saveGameStruct[] = {
+variable_desc saveGameStruct[] = {
   { &DISPCNT  , sizeof(u16) },
   { &DISPSTAT , sizeof(u16) },
   { &VCOUNT   , sizeof(u16) },
@@ -487,7 +488,17 @@ u32 myROM[] = {
   { &armMode , sizeof(int) },
   { &saveType , sizeof(int) },
   { NULL, 0 } 
-};*/
+};
+
+// what the DMA carries from one CPULoop to the next, which the old save states left out
+variable_desc saveDmaStruct[] = {
+  { &cpuDmaTicksToUpdate, sizeof(int) },
+  { &cpuDmaCount, sizeof(int) },
+  { &cpuDmaHack, sizeof(bool) },
+  { &cpuDmaLast, sizeof(u32) },
+  { &biosProtected[0], 4 },
+  { NULL, 0 }
+};
 
 int cpuLoopTicks = 0;
 int cpuSavedTicks = 0;
@@ -724,6 +735,68 @@ inline int CPUUpdateTicks()
 	return true;
 }*/
 
+// a state of the machine between two CPULoops, without its memory, which is one block
+// (see CPUArena) that a caller keeping many states is better off comparing by the page
+
+static bool CPUWriteState(gzFile gzFile)
+{
+  utilWriteInt(gzFile, SAVE_GAME_VERSION);
+  utilGzWrite(gzFile, &reg[0], sizeof(reg));
+  utilWriteData(gzFile, saveGameStruct);
+  utilWriteInt(gzFile, stopState ? 1 : 0);
+  utilWriteInt(gzFile, intState ? 1 : 0);
+  utilWriteData(gzFile, saveDmaStruct);
+  soundSaveGame(gzFile);
+  return true;
+}
+
+static bool CPUReadState(gzFile gzFile)
+{
+  if(utilReadInt(gzFile) != SAVE_GAME_VERSION)
+    return false;
+
+  utilGzRead(gzFile, &reg[0], sizeof(reg));
+  utilReadData(gzFile, saveGameStruct);
+  stopState = utilReadInt(gzFile) ? true : false;
+  intState = utilReadInt(gzFile) ? true : false;
+  utilReadData(gzFile, saveDmaStruct);
+  soundReadGame(gzFile, SAVE_GAME_VERSION);
+
+  // the wait states are tables made when WAITCNT is written
+  CPUUpdateRegister(0x204, READ16LE(&ioMem[0x204]));
+  layerEnable = layerSettings & DISPCNT;
+  return true;
+}
+
+// the state in memory as it is, no gzip; the size it took, or 0 if it didn't fit
+int CPUWriteMemState(char *memory, int available)
+{
+  gzFile gzFile = utilMemOpen(memory, available);
+  long size;
+
+  if(gzFile == NULL)
+    return 0;
+
+  CPUWriteState(gzFile);
+  size = utilMemTell(gzFile);
+  if(utilGzClose(gzFile) < 0)
+    return 0;
+  return (int)size;
+}
+
+bool CPUReadMemState(char *memory, int available)
+{
+  gzFile gzFile = utilMemOpen(memory, available);
+
+  if(gzFile == NULL)
+    return false;
+
+  bool res = CPUReadState(gzFile);
+  if(utilGzClose(gzFile) < 0)
+    res = false;
+  return res;
+}
+
 /*bool CPUReadGSASnapshot(const char *fileName)
 {
   int i;
@@ -942,6 +1015,58 @@ bool CPUIsELF(const char *file)
   return false;
 }*/
 
+// everything the GBA has besides the ROM is one block, taken the first time a track is
+// loaded and kept until exit. a track change only clears it, so switching doesn't go
+// through the allocator or fault in fresh pages, and the player's size doesn't move
+
+static const struct {
+  u8 **region;
+  int size;
+} cpuArenaRegions[] = {
+  { &workRAM,     0x40000 },
+  { &vram,        0x20000 },
+  { &internalRAM, 0x8000 },
+  { &bios,        0x4000 },
+  { &paletteRAM,  0x400 },
+  { &oam,         0x400 },
+  { &ioMem,       0x400 }
+};
+
+#define CPU_ARENA_REGIONS (int)(sizeof(cpuArenaRegions) / sizeof(cpuArenaRegions[0]))
+
+static u8 *cpuArena = NULL;
+static int cpuArenaSize = 0;
+
+u8 *CPUArena(int *size)
+{
+  *size = cpuArenaSize;
+  return cpuArena;
+}
+
+static bool CPUArenaSetup()
+{
+  int i, offset;
+
+  if(cpuArena == NULL) {
+    for(i = 0; i < CPU_ARENA_REGIONS; i++)
+      cpuArenaSize += cpuArenaRegions[i].size;
+    cpuArena = (u8 *)calloc(1, cpuArenaSize);
+    if(cpuArena == NULL) {
+      cpuArenaSize = 0;
+      return false;
+    }
+  } else {
+    memset(cpuArena, 0, cpuArenaSize);
+  }
+
+  for(i = 0, offset = 0; i < CPU_ARENA_REGIONS; i++) {
+    *cpuArenaRegions[i].region = cpuArena + offset;
+    offset += cpuArenaRegions[i].size;
+  }
+
+  return true;
+}
+
 void CPUCleanUp()
 {
 #ifdef PROFILING
@@ -951,49 +1076,18 @@ void CPUCleanUp()
 #endif
   
   if(rom != NULL) {
-    free(rom);
+    utilFreeImage(rom);
     rom = NULL;
   }
 
-  if(vram != NULL) {
-    free(vram);
-    vram = NULL;
-  }
-
-  if(paletteRAM != NULL) {
-    free(paletteRAM);
-    paletteRAM = NULL;
-  }
-  
-  if(internalRAM != NULL) {
-    free(internalRAM);
-    internalRAM = NULL;
-  }
-
-  if(workRAM != NULL) {
-    free(workRAM);
-    workRAM = NULL;
-  }
-
-  if(bios != NULL) {
-    free(bios);
-    bios = NULL;
-  }
-
-  //if(pix != NULL) {
-  //  free(pix);
-  //  pix = NULL;
-  //}
-
-  if(oam != NULL) {
-    free(oam);
-    oam = NULL;
-  }
-
-  if(ioMem != NULL) {
-    free(ioMem);
-    ioMem = NULL;
-  }
+  // the memory itself stays in the arena for the next track
+  vram = NULL;
+  paletteRAM = NULL;
+  internalRAM = NULL;
+  workRAM = NULL;
+  bios = NULL;
+  oam = NULL;
+  ioMem = NULL;
   
   //elfCleanUp();
 
@@ -1017,8 +1111,7 @@ int CPULoadRom(const char *szFile)
  //                 "ROM");
  //   return 0;
  // }
-  workRAM = (u8 *)calloc(1, 0x40000);
-  if(workRAM == NULL) {
+  if(!CPUArenaSetup()) {
     //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
     //              "WRAM");
     return 0;
@@ -1065,10 +1158,9 @@ int CPULoadRom(const char *szFile)
   //loadedsize = sizeof(*rom);
   
   if(!i) {
-    free(rom);
+    utilFreeImage(rom);
     rom = NULL;
-    free(workRAM);
-    workRAM = NULL;
+    CPUCleanUp();
     return 0;
   }
 
@@ -1079,56 +1171,6 @@ int CPULoadRom(const char *szFile)
     temp++;
   }*/
 
-  bios = (u8 *)calloc(1,0x4000);
-  if(bios == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "BIOS");
-    CPUCleanUp();
-    return 0;
-  }    
-  internalRAM = (u8 *)calloc(1,0x8000);
-  if(internalRAM == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "IRAM");
-    CPUCleanUp();
-    return 0;
-  }    
-  paletteRAM = (u8 *)calloc(1,0x400);
-  if(paletteRAM == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "PRAM");
-    CPUCleanUp();
-    return 0;
-  }      
-  vram = (u8 *)calloc(1, 0x20000);
-  if(vram == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "VRAM");
-    CPUCleanUp();
-    return 0;
-  }      
-  oam = (u8 *)calloc(1, 0x400);
-  if(oam == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "OAM");
-    CPUCleanUp();
-    return 0;
-  }      
-  //pix = (u8 *)calloc(1, 4 * 241 * 162);
-  //if(pix == NULL) {
-  //  systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-  //                "PIX");
-  //  CPUCleanUp();
-  //  return 0;
-  //}      
-  ioMem = (u8 *)calloc(1, 0x400);
-  if(ioMem == NULL) {
-    //systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
-    //              "IO");
-    CPUCleanUp();
-    return 0;
-  }      
-
 //  CPUUpdateRenderBuffers(true);
 
   return size;
@@ -2311,6 +2353,7 @@ void CPUUpdateRegister(u32 address, u16 value)
     break;
   case 0x100:
     timer0Reload = value;
+    interp_update_rate(0);
     break;
   case 0x102:
     timer0Ticks = timer0ClockReload = TIMER_TICKS[value & 3];        
@@ -2324,10 +2367,12 @@ void CPUUpdateRegister(u32 address, u16 value)
     timer0On = value & 0x80 ? true : false;
     TM0CNT = value & 0xC7;
     UPDATE_REG(0x102, TM0CNT);
+    interp_update_rate(0);
     //    CPUUpdateTicks();
     break;
   case 0x104:
     timer1Reload = value;
+    interp_update_rate(1);
     break;
   case 0x106:
     timer1Ticks = timer1ClockReload = TIMER_TICKS[value & 3];        
@@ -2341,6 +2386,7 @@ void CPUUpdateRegister(u32 address, u16 value)
     timer1On = value & 0x80 ? true : false;
     TM1CNT = value & 0xC7;
     UPDATE_REG(0x106, TM1CNT);
+    interp_update_rate(1);
     break;
   case 0x108:
     timer2Reload = value;
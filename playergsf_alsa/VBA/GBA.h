@@ -95,9 +95,10 @@ extern bool freezeInternalRAM[0x8000];
 //extern bool CPUWriteBMPFile(const char *);
 extern void CPUCleanUp();
 //extern void CPUUpdateRender();
-//extern bool CPUReadMemState(char *, int);
+extern bool CPUReadMemState(char *, int);
 extern bool CPUReadState(const char *);
-extern bool CPUWriteMemState(char *, int);
+extern int CPUWriteMemState(char *, int);
+extern u8 *CPUArena(int *);
 extern bool CPUWriteState(const char *);
 extern int CPULoadRom(const char *);
 extern void CPUUpdateRegister(u32, u16);
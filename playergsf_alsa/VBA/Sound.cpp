@@ -120,6 +120,9 @@ u16 directBuffer[2][735];
 #else
 u8 soundBuffer[6][735];
 #endif
+// whether the sound was on for each tick of the block still waiting to be mixed; a
+// tick with it off still outputs a sample, a silent one
+static u8 soundLive[735];
 //u16 soundFinalWave[1470];
 u16 soundFinalWave[2304];
 int soundBufferLen = 576;
@@ -130,6 +133,10 @@ int soundInterpolation = 4;
 #else
 int soundInterpolation = 0;
 #endif
+// mix at the tick rate with DirectSound held between samples, and resample the result
+int soundNativeMix = 0;
+// ticks still to go by unrendered, see soundSeek
+int soundSeekTicks = 0;
 int soundPaused = 1;
 int soundPlay = 0;
 int soundTicks = soundQuality * USE_TICKS_AS;
@@ -883,10 +890,12 @@ void soundChannel4()
   }
 }
 
+// with interpolation this renders the whole pending block at once, see soundFlush
+
 void soundDirectSoundA()
 {
 #ifndef NO_INTERPOLATION
-  directBuffer[0][soundIndex] = interp_pop(0, calc_rate(soundDSATimer)); //soundDSAValue;
+  interp_render(0, soundDSATimer, (s16 *)directBuffer[0], soundIndex);
 #else
   soundBuffer[4][soundIndex] = soundDSAValue;
 #endif
@@ -910,7 +919,8 @@ void soundDirectSoundATimer()
     }
     
     soundDSAValue = (soundDSFifoA[soundDSFifoAIndex]);
-    interp_push(0, (s8)soundDSAValue << 8);
+    if(!soundNativeMix && !soundSeekTicks)
+      interp_push(0, (s8)soundDSAValue << 8);
     soundDSFifoAIndex = (++soundDSFifoAIndex) & 31;
     soundDSFifoACount--;
   } else
@@ -920,7 +930,7 @@ void soundDirectSoundATimer()
 void soundDirectSoundB()
 {
 #ifndef NO_INTERPOLATION
-  directBuffer[1][soundIndex] = interp_pop(1, calc_rate(soundDSBTimer)); //soundDSBValue;
+  interp_render(1, soundDSBTimer, (s16 *)directBuffer[1], soundIndex);
 #else
   soundBuffer[5][soundIndex] = soundDSBValue;
 #endif
@@ -944,7 +954,8 @@ void soundDirectSoundBTimer()
     }
     
     soundDSBValue = (soundDSFifoB[soundDSFifoBIndex]);
-    interp_push(1, (s8)soundDSBValue << 8);
+    if(!soundNativeMix && !soundSeekTicks)
+      interp_push(1, (s8)soundDSBValue << 8);
     soundDSFifoBIndex = (++soundDSFifoBIndex) & 31;
     soundDSFifoBCount--;
   } else {
@@ -966,7 +977,7 @@ void soundTimerOverflow(int timer)
 #define max(a,b) (a)<(b)?(b):(a)
 #endif
 
-extern "C" int relvolume;
+// the volume tag is applied after the mix, with the fade, see snd_dsp.h
 
 #ifndef NO_INTERPOLATION
 void soundMix()
@@ -1053,8 +1064,6 @@ void soundMix()
     break;
   }
 
-  res = (int)((float) res * ((float)relvolume / 1000.0));
-  
   if(res > 32767)
     res = 32767;
   if(res < -32768)
@@ -1147,8 +1156,6 @@ void soundMix()
     break;
   }
   
-  res = (int)((float) res * ((float)relvolume / 1000.));
-
   if(res > 32767)
     res = 32767;
   if(res < -32768)
@@ -1245,8 +1252,6 @@ void soundMix()
     break;
   }
 
-  res = (int)((float) res * ((float)relvolume / 1000.0));
-  
   if(res > 32767)
     res = 32767;
   if(res < -32768)
@@ -1338,8 +1343,6 @@ void soundMix()
     break;
   }
 
-  res = (float) res * ((float)relvolume / 1000.);
-  
   if(res > 32767)
     res = 32767;
   if(res < -32768)
@@ -1424,20 +1427,12 @@ void soundTick()
 
 //#ifndef LINUX
 #if 1
-void soundTick()
+// mixes and post-processes the sample at soundIndex, once its channels are all rendered
+
+static void soundOutput(bool live)
 {
-	//if (seek_needed == -1)		//if no seek is needed
-	if (1)
-	{
-		//if(systemSoundOn) {						//needed?  I don't think so
-		if(soundMasterOn && !stopState) 
+		if(live) 
 		{
-			soundChannel1();
-			soundChannel2();
-			soundChannel3();
-			soundChannel4();
-			soundDirectSoundA();
-			soundDirectSoundB();
 			if ((decode_pos_ms  < TrackLength) || IgnoreTrackLength || playforever)
 				soundMix();
 			else
@@ -1520,28 +1515,11 @@ void soundTick()
 				}
 
 			}
-			//check for fade...
-			if ((decode_pos_ms  >= TrackLength-FadeLength) && !IgnoreTrackLength && !playforever)
+			//check for the end, the fade and the silence after it being the output stage's
+			if ((playtime >= (TrackLength + TrailingSilence)) && !IgnoreTrackLength && !playforever)
 			{
-				//if (decode_pos_ms - (mod.outMod->GetWrittenTime()-mod.outMod->GetOutputTime()) < TrackLength)		//if we're in the fade zone
-				if(playtime < TrackLength)
-				{
-					((short *)soundFinalWave)[soundBufferIndex-2] *= (float)(1-((decode_pos_ms-(TrackLength-FadeLength))/FadeLength));
-					((short *)soundFinalWave)[soundBufferIndex-1] *= (float)(1-((decode_pos_ms-(TrackLength-FadeLength))/FadeLength));
-				}
-				else if(playtime < (TrackLength + TrailingSilence))
-				{
-					soundFinalWave[soundBufferIndex-2] = 0;
-					soundFinalWave[soundBufferIndex-1] = 0;
-				}
-				else
-				{
-					soundFinalWave[soundBufferIndex-2] = 0;
-					soundFinalWave[soundBufferIndex-1] = 0;
-					outputtimeread=0;
-					//DisplayError("playtime=%d, tracklength=%d, decode_pos_ms=%d\nGetOutputTime()=%d, GetWrittenTime=%d",(int)playtime,(int)TrackLength, (int)decode_pos_ms,mod.outMod->GetOutputTime(),mod.outMod->GetWrittenTime());
-					end_of_track();
-				}
+				outputtimeread=0;
+				end_of_track();
 			}
 		
 //			printf("TS: %d\n", TrailingSilence);
@@ -1552,36 +1530,117 @@ void soundTick()
 				soundFinalWave[soundBufferIndex++] = 0;
 				soundFinalWave[soundBufferIndex++] = 0;
 			}
-		  
-			soundIndex++;
-		    
-			if(2*soundBufferIndex >= soundBufferLen) 
-			{
-				if(systemSoundOn) 
-				{
-					if(soundPaused) {
-						soundResume();
-					}      
-		        
-					systemWriteDataToSoundBuffer();
-				}
-				soundIndex = 0;
-				soundBufferIndex = 0;
-			}
-		//	}
-		//}
+}
+
+// the DirectSound channels are rendered a block at a time, so everything downstream of
+// them runs here once the block is complete rather than on every tick
+
+static void soundFlush()
+{
+	int count = soundIndex;
+
+#ifndef NO_INTERPOLATION
+	if(!soundNativeMix) {
+		soundDirectSoundA();
+		soundDirectSoundB();
 	}
-//	/*
-	else
+#endif
+
+	soundBufferIndex = 0;
+	for(soundIndex = 0; soundIndex < count; soundIndex++)
+		soundOutput(soundLive[soundIndex] != 0);
+
+#ifndef NO_INTERPOLATION
+	if(soundNativeMix)
+		soundBufferIndex = 2 * interp_resample_mix(soundFinalWave, count, sndSamplesPerSec);
+#endif
+
+	if(systemSoundOn) 
 	{
-		//decode_pos_ms += (1. / 44100.) * (double)soundQuality; //0.02267276353518178520905584379325; //mathematically, i couldn't obtain this exact number.  Found it from testing.  This is an average, but really close.
-		decode_pos_ms += (1./44100.)*1000.;
-		didseek=true;
-		if (decode_pos_ms >= seek_needed)
-			seek_needed = -1;
+		if(soundPaused) {
+			soundResume();
+		}      
+        
+		systemWriteDataToSoundBuffer();
+	}
+	soundIndex = 0;
+	soundBufferIndex = 0;
+}
+
+// a seek lets ticks go by without rendering, mixing or writing anything. the PSG
+// channels are still stepped, since their length, envelope and sweep counters are
+// what the game sees in NR52 and hears afterwards, but DirectSound only has its FIFOs
+// drained. the block pending when it starts is dropped, so a seek of ticks lands that
+// many ticks after the last one written
+
+static void soundSeekDone()
+{
+	// nothing was fed to the resamplers meanwhile, they start over from silence
+	interp_reset(0);
+	interp_reset(1);
+	interp_reset(2);
+	interp_reset(3);
+	didseek = true;
+}
 
+void soundSeek(int ticks)
+{
+	soundSeekTicks = ticks > 0 ? ticks : 0;
+	soundIndex = 0;
+	soundBufferIndex = 0;
+	if(!soundSeekTicks)
+		soundSeekDone();
+}
+
+static void soundSkip()
+{
+	if(soundMasterOn && !stopState) 
+	{
+		soundChannel1();
+		soundChannel2();
+		soundChannel3();
+		soundChannel4();
 	}
-//	*/		
+
+	if(--soundSeekTicks == 0)
+		soundSeekDone();
+}
+
+void soundTick()
+{
+	if(soundSeekTicks)
+	{
+		soundSkip();
+		return;
+	}
+
+	if(soundMasterOn && !stopState) 
+	{
+		soundChannel1();
+		soundChannel2();
+		soundChannel3();
+		soundChannel4();
+#ifdef NO_INTERPOLATION
+		soundDirectSoundA();
+		soundDirectSoundB();
+#else
+		if(soundNativeMix) {
+			directBuffer[0][soundIndex] = (s8)soundDSAValue << 8;
+			directBuffer[1][soundIndex] = (s8)soundDSBValue << 8;
+		}
+#endif
+		soundLive[soundIndex] = 1;
+	}
+	else
+		// a silent sample, as the per-tick soundTick wrote when the sound was off, so
+		// decode_pos_ms and the track's timing run on as they did; only the silence
+		// detection and the fade skip it, as they always have
+		soundLive[soundIndex] = 0;
+
+	soundIndex++;
+
+	if(4*soundIndex >= soundBufferLen) 
+		soundFlush();
 }
 #endif
 
@@ -1633,9 +1692,14 @@ void soundReset()
   soundPlay = 0;
   SOUND_CLOCK_TICKS = soundQuality * USE_TICKS_AS;  
   soundTicks = SOUND_CLOCK_TICKS;
+  interp_update_rate(0);
+  interp_update_rate(1);
+  interp_reset(2);
+  interp_reset(3);
   soundNextPosition = 0;
   soundMasterOn = 1;
   soundIndex = 0;
+  soundSeekTicks = 0;
   soundBufferIndex = 0;
   soundLevel1 = 7;
   soundLevel2 = 7;
@@ -1750,11 +1814,15 @@ void soundSetQuality(int quality)
     if(!soundOffFlag)
       soundInit();
     SOUND_CLOCK_TICKS = USE_TICKS_AS * soundQuality;
+    interp_update_rate(0);
+    interp_update_rate(1);
     soundIndex = 0;
     soundBufferIndex = 0;
   } else if(soundQuality != quality) {
     soundNextPosition = 0;
     SOUND_CLOCK_TICKS = USE_TICKS_AS * soundQuality;
+    interp_update_rate(0);
+    interp_update_rate(1);
     soundIndex = 0;
     soundBufferIndex = 0;
   }
@@ -1789,4 +1857,7 @@ void soundReadGame(gzFile gzFile, int version)
   
   sound1Wave = soundWavePattern[ioMem[NR11] >> 6];
   sound2Wave = soundWavePattern[ioMem[NR21] >> 6];
+
+  interp_update_rate(0);
+  interp_update_rate(1);
 }
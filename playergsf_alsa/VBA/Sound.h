@@ -48,6 +48,7 @@
 #define FIFOB_H 0xa6
 
 extern void soundTick();
+extern void soundSeek(int);
 extern void soundShutdown();
 extern bool soundInit();
 extern void soundPause();
@@ -73,6 +74,8 @@ extern int soundPaused;
 extern bool soundOffFlag;
 extern int soundQuality;
 extern int soundInterpolation;
+extern int soundNativeMix;
+extern int soundSeekTicks;
 extern int soundBufferLen;
 extern int soundBufferTotalLen;
 extern u32 soundNextPosition;
@@ -49,6 +49,9 @@ extern "C" {
 #include "memgzio.h"
 #include "psftag.h"
 }
+#include "archive.h"
+#include "lazyrom.h"
+#include "shmrom.h"
 
 #ifndef _MSC_VER
 #define _stricmp strcasecmp
@@ -491,6 +494,7 @@ static int utilReadInt3(FILE *f)
 extern bool cpuIsMultiBoot;
 
 Byte *compbuf;
+static unsigned int compbufsize;			// compbuf is kept and only grown
 Byte *uncompbuf;
 
 extern "C" int TrackLength;
@@ -567,7 +571,7 @@ extern "C"
 struct GSF_FILE {
 	Byte *program;
 	Byte *reserved;
-	char psftag[50001];
+	struct psftag_table tags;
 	char libname[0x40];
 	bool gsfloaded;
 };
@@ -577,12 +581,12 @@ static void copy_int(unsigned int *dst, unsigned char *src)
 	*dst = src[0] | (src[1]<<8) | (src[2]<<16) | (src[3]<<24);
 }
 
-static int fread_int(unsigned int *dst, FILE *f)
+static int fread_int(unsigned int *dst, void *f)
 {
 	unsigned char tmpbuf[4];
 	int r;
 
-	r = fread(tmpbuf,1,4,f);
+	r = archive_read(f,tmpbuf,4);
 	if (r<0) { return r; }
 	
 	*dst = tmpbuf[0] | (tmpbuf[1]<<8) | (tmpbuf[2]<<16) | (tmpbuf[3]<<24);
@@ -590,64 +594,124 @@ static int fread_int(unsigned int *dst, FILE *f)
 	return r;
 }
 
+// the program's own header gives its size, so the first 12 bytes are inflated on their
+// own, and then the rest straight into a buffer that fits it
+static Byte *inflateProgram(Byte *comp, unsigned int len, unsigned long *size)
+{
+	z_stream s;
+	Byte head[12];
+	Byte *out;
+	unsigned int tmpval;
+	int r = Z_OK;
+
+	memset(&s, 0, sizeof(s));
+	if(inflateInit(&s) != Z_OK)
+		return NULL;
+
+	s.next_in = comp;
+	s.avail_in = len;
+	s.next_out = head;
+	s.avail_out = sizeof(head);
+	while(s.avail_out && r == Z_OK)
+		r = inflate(&s, Z_NO_FLUSH);
+
+	if(s.avail_out)
+	{
+		inflateEnd(&s);
+		return NULL;
+	}
+
+	copy_int(&tmpval, head+8);
+	if(tmpval > 0x2000000)
+	{
+		inflateEnd(&s);
+		return NULL;
+	}
+	// a byte to spare, so the end of the stream fits even when the program fills it
+	out = (Byte*) malloc(12 + tmpval + 1);
+	if(out == NULL)
+	{
+		inflateEnd(&s);
+		return NULL;
+	}
+	memcpy(out, head, 12);
+
+	s.next_out = out + 12;
+	s.avail_out = tmpval + 1;
+	if(r == Z_OK)
+		r = inflate(&s, Z_FINISH);
+	*size = s.total_out;
+	inflateEnd(&s);
+
+	if(r != Z_STREAM_END)
+	{
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+// the raw tag of the file being read; what's kept is the table parsed from it
+static char tagbuf[50001];
+
 GSF_FILE decompressGSF(const char * file, int libnum=1)
 {
 	GSF_FILE gsffile;
 	char libtag[0x40];
 	char libname[0x8];
 	unsigned int filesize;
-    unsigned int header;
-    unsigned int reserved;
-    unsigned int program;
-    unsigned int ccrc;
+    unsigned int header = 0;
+    unsigned int reserved = 0;
+    unsigned int program = 0;
+    unsigned int ccrc = 0;
     unsigned long decompsize=12;
 	unsigned int tmpval;
-	FILE *f;
-	memset(gsffile.psftag,0,sizeof(gsffile.psftag));
+	void *f;
+	memset(tagbuf,0,sizeof(tagbuf));
+	gsffile.tags.count=0;
 	gsffile.program=NULL;
 	gsffile.reserved=NULL;
 	memset(gsffile.libname,0,sizeof(gsffile.libname));
 	gsffile.gsfloaded = false;
 	
-	f=fopen(file,"rb");
+	// a plain file, or a member of a zip inflated as it is read
+	f=archive_open(file,&filesize);
 	 
      if(f==NULL) {
 #ifdef LINUX
-		 perror("fopen");
+		 fprintf(stderr, "Cannot open %s\n", file);
 #endif
 		  return gsffile;
 	 }
-	  fseek(f,0,SEEK_END); filesize=ftell(f); fseek(f,0,SEEK_SET);
 	
-	  if((filesize<0x10)||(filesize>0x4000000))
+	  // the sizes say the file is all there, but a member of a zip may still end short
+	  if((filesize<0x10)||(filesize>0x4000000)||
+	     (fread_int(&header, f)!=4)||(fread_int(&reserved, f)!=4)||
+	     (fread_int(&program, f)!=4)||(fread_int(&ccrc, f)!=4))
 	  {
-		  fclose(f);
+		  archive_close(f);
 #ifdef LINUX
 			  printf("Bad file size\n");
 #endif
 		  return gsffile;
 	  }
 //	  fread(&header,1,4,f);
-	  fread_int(&header, f);
 	  
 	  if(header!=0x22465350)
 	  {
-		  fclose(f);
+		  archive_close(f);
 #ifdef LINUX
 			  printf("Bad header\n");
 #endif
 		  return gsffile;
 	  }
-	  fread_int(&reserved, f);
 //	  fread(&reserved,1,4,f);
-	  fread_int(&program, f);
 //	  fread(&program,1,4,f);
 //	  fread(&ccrc,1,4,f);
-	  fread_int(&ccrc, f);
 	  
 	  if((reserved+program+16)>filesize)
 	  {
-		  fclose(f);
+		  archive_close(f);
 #ifdef LINUX
 			  printf("Incoherant sizes\n");
 #endif
@@ -659,85 +723,58 @@ GSF_FILE decompressGSF(const char * file, int libnum=1)
 		  gsffile.reserved = (Byte*) malloc(reserved);
 		  if(gsffile.reserved==NULL)
 		  {
-			  fclose(f);
+			  archive_close(f);
 #ifdef LINUX
 			  printf("1: Malloc failed %d\n", reserved);
 #endif
 			  return gsffile;
 		  }
-		  fread(gsffile.reserved,1,reserved,f);
+		  archive_read(f,gsffile.reserved,reserved);
 	  }
 	
-	  if(program>0)
+	  // the main library may already be inflated by another player, or can be left
+	  // compressed, to be inflated as it is read
+	  if(program>0 && libnum==2)
 	  {
-			compbuf = (Byte*) malloc(program);
+			gsffile.program = shmrom_open(file,reserved,program,ccrc);
+			if(gsffile.program==NULL && lazyrom_possible(file,program))
+				gsffile.program = lazyrom_open(file,16+reserved,program,ccrc);
+			if(gsffile.program)
+				archive_skip(f,program);
+	  }
+
+	  if(program>0 && gsffile.program==NULL)
+	  {
+			if(program>compbufsize)
+			{
+				free(compbuf);
+				compbuf = (Byte*) malloc(program);
+				compbufsize = compbuf ? program : 0;
+			}
 			if(compbuf==NULL)
 			{
-				fclose(f);
+				archive_close(f);
 #ifdef LINUX
 			  printf("2: Malloc failed %d\n", program);
 #endif
 				return gsffile;
 			}
 			 
-			fread(compbuf,1,program,f);
+			archive_read(f,compbuf,program);
 	//  		fread_int(&program, f);
 			  
 			if(ccrc != crc32(crc32(0L, Z_NULL, 0), compbuf, program))
 			{
-				fclose(f);
-				free(compbuf);
+				archive_close(f);
 #ifdef LINUX
 			  printf("Bad crc\n");
 #endif
 				return gsffile;
 			}
-			uncompbuf = (Byte*) malloc(decompsize);
-			if (uncompbuf == NULL)
-			{
-				fclose(f);
-				free(compbuf);
-#ifdef LINUX
-			  printf("3: Malloc failed %d\n", decompsize);
-#endif
-				return gsffile;
-			}
-			if(uncompress(uncompbuf,&decompsize,compbuf,program)!=Z_BUF_ERROR)
-			{
-#ifdef LINUX
-			  printf("uncompression error\n");
-#endif
-				fclose(f);
-				free(compbuf);
-				free(uncompbuf);
-				return gsffile;
-			}
-			//memcpy(&decompsize,uncompbuf+8,sizeof(decompsize));
-		
-			//memcpy(&tmpval,uncompbuf+8,sizeof(tmpval));
-			copy_int(&tmpval, uncompbuf+8);
-			
-			decompsize = tmpval;
-			free(uncompbuf);
-			decompsize +=12;
-			uncompbuf = (Byte*) malloc(decompsize);
+			uncompbuf = inflateProgram(compbuf, program, &decompsize);
 			if (uncompbuf == NULL)
 			{
-				fclose(f);
-				free(compbuf);
-#ifdef LINUX
-				perror("malloc");
-			  printf("4: Malloc failed %d\n", decompsize);
-#endif
-				return gsffile;
-			}
-
-			
-			if(uncompress(uncompbuf,&decompsize,compbuf,program) != Z_OK)
-			{
-				fclose(f);
-				free(compbuf);
-				free(uncompbuf);
+				archive_close(f);
 #ifdef LINUX
 			  printf("uncompress error\n");
 #endif
@@ -748,20 +785,31 @@ GSF_FILE decompressGSF(const char * file, int libnum=1)
 			if((*uncompbuf==0x02)&&(libnum==1))
 				cpuIsMultiBoot = true;
 			uncompbuf-=3;
-			free(compbuf);
+			// and left for the next player to map
+			if(libnum==2)
+			{
+				Byte *shared = shmrom_store(file,reserved,program,ccrc,uncompbuf,decompsize);
+				if(shared)
+				{
+					free(uncompbuf);
+					uncompbuf = shared;
+				}
+			}
 			gsffile.program=uncompbuf;
 	  }
-	  fread(gsffile.psftag,1,5,f);
+	  archive_read(f,tagbuf,5);
 #ifdef LINUX
-	  if(!strcasecmp(gsffile.psftag,"[TAG]"))
+	  if(!strcasecmp(tagbuf,"[TAG]"))
 	  {
-	    fread(gsffile.psftag,1,50000,f);
+	    archive_read(f,tagbuf,50000);
+	    psftag_parse(&gsffile.tags,tagbuf);
 	  }
 	
 #else
-	  if(!stricmp(gsffile.psftag,"[TAG]"))
+	  if(!stricmp(tagbuf,"[TAG]"))
 	  {
-	    fread(gsffile.psftag,1,50000,f);
+	    archive_read(f,tagbuf,50000);
+	    psftag_parse(&gsffile.tags,tagbuf);
 	  }
 #endif
 
@@ -769,12 +817,12 @@ GSF_FILE decompressGSF(const char * file, int libnum=1)
 		  sprintf(libname,"_lib");
 	  else
 		  sprintf(libname,"_lib%d",libnum);
-	  if(!psftag_raw_getvar(gsffile.psftag,libname,libtag,sizeof(libtag)-1))
+	  if(!psftag_table_getvar(&gsffile.tags,libname,libtag,sizeof(libtag)-1))
 	  {
 		  memcpy(gsffile.libname,libtag,sizeof(gsffile.libname));
 	  }
 
-	  fclose(f);
+	  archive_close(f);
 	  if((program+reserved)==0)
 	  {
 		  return gsffile;
@@ -813,7 +861,7 @@ bool utildecompGSF(const char * file)
 
     // Intentar cargar la librería base _lib
     memset(libtag, 0, sizeof(libtag));
-    if (!psftag_raw_getvar(gsffile.psftag, "_lib", libtag, sizeof(libtag) - 1) && strlen(libtag) > 0) {
+    if (!psftag_table_getvar(&gsffile.tags, "_lib", libtag, sizeof(libtag) - 1) && strlen(libtag) > 0) {
 
 #ifdef LINUX
         sprintf(filename, "%s/%s", tempname, libtag);
@@ -821,16 +869,16 @@ bool utildecompGSF(const char * file)
         sprintf(filename, "%s\\%s", tempname, libtag);
 #endif
 
-        if (access(filename, R_OK) != 0) {
+        if (!archive_exists(filename)) {
             fprintf(stderr, "Library file not found: %s\n", filename);
-            free(uncompbuf);
+            utilFreeImage(uncompbuf);
             return false;
         }
 
         gsflib[1] = decompressGSF(filename, 2);
         if (!gsflib[1].gsfloaded) {
             printf("Failed to load library: %s\n", filename);
-            free(uncompbuf);
+            utilFreeImage(uncompbuf);
             return false;
         }
 
@@ -850,7 +898,7 @@ bool utildecompGSF(const char * file)
             // Buscar en las libs anteriores si alguna declara este _libX
             bool found = false;
             for (int j = 0; j < i; j++) {
-                if (!psftag_raw_getvar(gsflib[j].psftag, libname, libtag, sizeof(libtag) - 1)
+                if (!psftag_table_getvar(&gsflib[j].tags, libname, libtag, sizeof(libtag) - 1)
                     && strlen(libtag) > 0) {
 
 #ifdef LINUX
@@ -859,15 +907,15 @@ bool utildecompGSF(const char * file)
                     sprintf(filename, "%s\\%s", tempname, libtag);
 #endif
 
-                    if (access(filename, R_OK) != 0) {
+                    if (!archive_exists(filename)) {
                         fprintf(stderr, "Library file not found: %s\n", filename);
-                        free(uncompbuf);
+                        utilFreeImage(uncompbuf);
                         return false;
                     }
 
                     gsflib[i] = decompressGSF(filename, i + 1);
                     if (!gsflib[i].gsfloaded) {
-                        free(uncompbuf);
+                        utilFreeImage(uncompbuf);
                         return false;
                     }
 
@@ -892,13 +940,13 @@ bool utildecompGSF(const char * file)
     }
 
     // Procesar tags length/fade/volume
-    if (!psftag_raw_getvar(gsffile.psftag, "length", length, sizeof(length) - 1) && strlen(length))
+    if (!psftag_table_getvar(&gsffile.tags, "length", length, sizeof(length) - 1) && strlen(length))
         TrackLength = LengthFromString(length);
 
     if (TrackLength <= 0 && IgnoreTrackLength)
         TrackLength = 0;
 
-    if (!psftag_raw_getvar(gsffile.psftag, "fade", fade, sizeof(fade) - 1) && strlen(fade)) {
+    if (!psftag_table_getvar(&gsffile.tags, "fade", fade, sizeof(fade) - 1) && strlen(fade)) {
         FadeLength = LengthFromString(fade);
         TrackLength += FadeLength;
     }
@@ -909,7 +957,7 @@ bool utildecompGSF(const char * file)
     }
 
     relvolume = 0;
-    if (!psftag_raw_getvar(gsffile.psftag, "volume", volume, sizeof(volume) - 1) && strlen(volume))
+    if (!psftag_table_getvar(&gsffile.tags, "volume", volume, sizeof(volume) - 1) && strlen(volume))
         relvolume = VolumeFromString(volume);
 
     if (relvolume == 0)
@@ -1381,6 +1429,43 @@ static u8 *utilLoadRarFile(const char *file,
 }
 #endif*/
 
+// a ROM that was inflated rather than mapped is copied into the same buffer every track,
+// which only grows. what the last ROM left past the end of this one is cleared, so reads
+// past the end give zero as they do from a mapped library
+static u8 *romBuffer = NULL;
+static int romBufferSize = 0;
+static int romBufferUsed = 0;
+
+static u8 *utilRomBuffer(int size, int programsize)
+{
+  if(size > romBufferSize) {
+    free(romBuffer);
+    romBuffer = (u8 *)calloc(1, size);
+    romBufferSize = romBuffer ? size : 0;
+    romBufferUsed = 0;
+    if(romBuffer == NULL)
+      return NULL;
+  }
+
+  if(romBufferUsed > programsize)
+    memset(romBuffer + programsize, 0, romBufferUsed - programsize);
+  romBufferUsed = programsize;
+
+  return romBuffer;
+}
+
+void utilFreeImage(u8 *image)
+{
+  if(image == romBuffer)
+    return;
+  if(lazyrom_owns(image))
+    lazyrom_close();
+  else if(shmrom_owns(image))
+    shmrom_close();
+  else
+    free(image);
+}
+
 u8 *utilLoad(const char *file,
              bool (*accept)(const char *),
              u8 *data,
@@ -1405,8 +1490,14 @@ u8 *utilLoad(const char *file,
 //	 memcpy(&programsize,uncompbuf+8,sizeof(programsize));
 	 copy_int(&programsize, uncompbuf+8);
 	 loadedsize = size = programsize;
+	 // a mapped library is used in place; copying it would inflate it all, or lose the
+	 // pages it shares with other players
+	 if(image == NULL && (lazyrom_owns(uncompbuf) || shmrom_owns(uncompbuf))) {
+		loadedsize = utilGetSize(size);
+		return uncompbuf+12;
+	 }
 	 if(image == NULL) {
-		image = (u8 *)malloc(utilGetSize(size));
+		image = utilRomBuffer(utilGetSize(size), size);
 		loadedsize = utilGetSize(size);
 		if(image == NULL) {
 		//systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
@@ -1415,7 +1506,7 @@ u8 *utilLoad(const char *file,
 		}
      }
 	 memcpy(image,uncompbuf+12,programsize);
-	 free(uncompbuf);
+	 utilFreeImage(uncompbuf);
 	 return image;
   }
   
@@ -1507,6 +1598,68 @@ gzFile utilMemGzOpen(char *memory, int available, char *mode)
   return memgzopen(memory, available, mode);  
 }
 
+// a plain window on memory behind the same calls, for states that are only kept while
+// the player runs, where deflating them would cost more than it saves
+
+struct utilMemStream {
+  char *memory;
+  int available;
+  int pos;
+  bool overrun;
+};
+
+static int ZEXPORT utilMemWrite(gzFile file, voidpc buffer, unsigned int len)
+{
+  utilMemStream *s = (utilMemStream *)file;
+  if(len > (unsigned int)(s->available - s->pos)) {
+    s->overrun = true;
+    return -1;
+  }
+  memcpy(s->memory + s->pos, buffer, len);
+  s->pos += len;
+  return len;
+}
+
+static int ZEXPORT utilMemRead(gzFile file, voidp buffer, unsigned int len)
+{
+  utilMemStream *s = (utilMemStream *)file;
+  if(len > (unsigned int)(s->available - s->pos)) {
+    s->overrun = true;
+    return -1;
+  }
+  memcpy(buffer, s->memory + s->pos, len);
+  s->pos += len;
+  return len;
+}
+
+static int ZEXPORT utilMemClose(gzFile file)
+{
+  utilMemStream *s = (utilMemStream *)file;
+  int res = s->overrun ? -1 : 0;
+  free(s);
+  return res;
+}
+
+gzFile utilMemOpen(char *memory, int available)
+{
+  utilMemStream *s = (utilMemStream *)calloc(1, sizeof(utilMemStream));
+  if(s == NULL)
+    return NULL;
+
+  utilGzWriteFunc = utilMemWrite;
+  utilGzReadFunc = utilMemRead;
+  utilGzCloseFunc = utilMemClose;
+
+  s->memory = memory;
+  s->available = available;
+  return (gzFile)s;
+}
+
+long utilMemTell(gzFile file)
+{
+  return ((utilMemStream *)file)->pos;
+}
+
 int utilGzWrite(gzFile file, const voidp buffer, unsigned int len)
 {
   return utilGzWriteFunc(file, buffer, len);
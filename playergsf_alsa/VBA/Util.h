@@ -49,6 +49,7 @@ extern u8 *utilLoad(const char *,
                     bool (*)(const char*),
                     u8 *,
                     int &);
+extern void utilFreeImage(u8 *);
 
 extern void utilPutDword(u8 *, u32);
 extern void utilPutWord(u8 *, u16);
@@ -62,5 +63,7 @@ extern int utilGzWrite(gzFile file, const voidp buffer, unsigned int len);
 extern int utilGzRead(gzFile file, voidp buffer, unsigned int len);
 extern int utilGzClose(gzFile file);
 extern long utilGzMemTell(gzFile file);
+extern gzFile utilMemOpen(char *memory, int available);
+extern long utilMemTell(gzFile file);
 extern void utilGBAFindSave(const u8 *, const int);
 #endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "unzip.h"
+#include "archive.h"
+#include "psftag.h"
+
+// the central directory of the archive in use is walked once, when it is first opened,
+// and kept sorted by name with where each entry sits, so looking up a member is a
+// binary search instead of a pass over the whole directory on the card. the archive
+// stays open until another one is asked for or it changes on disk; one is all a set
+// needs, since its minigsfs and gsflib live together
+
+struct zip_entry
+{
+	std::string name;
+	unz_file_pos pos;
+	unsigned int size;
+};
+
+struct zip_index
+{
+	std::string path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	unzFile unz;
+	std::vector<zip_entry> entries;
+};
+
+static zip_index current;
+
+struct archive_file
+{
+	FILE *f;
+	unzFile unz;
+};
+
+static bool entry_less(const zip_entry & a, const zip_entry & b)
+{
+	return strcasecmp(a.name.c_str(), b.name.c_str()) < 0;
+}
+
+static void close_index(void)
+{
+	if (current.unz)
+	{
+		unzClose(current.unz);
+		current.unz = NULL;
+	}
+	current.path.clear();
+	current.entries.clear();
+}
+
+static zip_index *open_index(const char *archive)
+{
+	char name[PATH_MAX];
+	unz_file_info info;
+	struct stat st;
+	int r;
+
+	if (stat(archive, &st) || !S_ISREG(st.st_mode)) return NULL;
+
+	if (current.unz && current.path == archive && current.dev == st.st_dev &&
+	    current.ino == st.st_ino && current.size == st.st_size && current.mtime == st.st_mtime)
+	{
+		return &current;
+	}
+
+	close_index();
+
+	current.unz = unzOpen(archive);
+	if (!current.unz) return NULL;
+
+	for (r = unzGoToFirstFile(current.unz); r == UNZ_OK; r = unzGoToNextFile(current.unz))
+	{
+		zip_entry e;
+
+		if (unzGetCurrentFileInfo(current.unz, &info, name, sizeof(name), NULL, 0, NULL, 0) != UNZ_OK) break;
+		if (!name[0] || name[strlen(name) - 1] == '/') continue;
+		if (unzGetFilePos(current.unz, &e.pos) != UNZ_OK) break;
+
+		e.name = name;
+		e.size = info.uncompressed_size;
+		current.entries.push_back(e);
+	}
+
+	std::sort(current.entries.begin(), current.entries.end(), entry_less);
+
+	current.path = archive;
+	current.dev = st.st_dev;
+	current.ino = st.st_ino;
+	current.size = st.st_size;
+	current.mtime = st.st_mtime;
+
+	return &current;
+}
+
+// names in a zip are case sensitive, but the tags that point at them were mostly
+// written on systems where they aren't, so neither is this
+static const zip_entry *find_member(zip_index *z, const char *member)
+{
+	zip_entry key;
+	std::vector<zip_entry>::const_iterator i;
+
+	key.name = member;
+	i = std::lower_bound(z->entries.begin(), z->entries.end(), key, entry_less);
+	if (i == z->entries.end() || strcasecmp(i->name.c_str(), member)) return NULL;
+
+	return &*i;
+}
+
+// a member path is the archive, which has to be a file, a slash, then the name inside
+int archive_split(const char *path, char *archive, char *member)
+{
+	char buffer[PATH_MAX];
+	struct stat st;
+	const char *p;
+	size_t len;
+
+	for (p = path; (p = strchr(p, '/')) != NULL; p++)
+	{
+		len = p - path;
+		if (len < 4 || len >= sizeof(buffer) || strncasecmp(p - 4, ".zip", 4)) continue;
+
+		memcpy(buffer, path, len);
+		buffer[len] = 0;
+		if (stat(buffer, &st) || !S_ISREG(st.st_mode)) continue;
+
+		if (archive) strcpy(archive, buffer);
+		if (member) snprintf(member, PATH_MAX, "%s", p + 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+int archive_exists(const char *path)
+{
+	char archive[PATH_MAX], member[PATH_MAX];
+	zip_index *z;
+
+	if (!archive_split(path, archive, member)) return access(path, R_OK) == 0;
+
+	z = open_index(archive);
+	return z && find_member(z, member);
+}
+
+void *archive_open(const char *path, unsigned int *size)
+{
+	char archive[PATH_MAX], member[PATH_MAX];
+	archive_file *file;
+	const zip_entry *e;
+	zip_index *z;
+
+	file = (archive_file *)calloc(1, sizeof(archive_file));
+	if (!file) return NULL;
+
+	if (!archive_split(path, archive, member))
+	{
+		file->f = fopen(path, "rb");
+		if (!file->f)
+		{
+			free(file);
+			return NULL;
+		}
+		fseek(file->f, 0, SEEK_END);
+		*size = ftell(file->f);
+		fseek(file->f, 0, SEEK_SET);
+		return file;
+	}
+
+	z = open_index(archive);
+	e = z ? find_member(z, member) : NULL;
+	if (!e || unzGoToFilePos(z->unz, &e->pos) != UNZ_OK || unzOpenCurrentFile(z->unz) != UNZ_OK)
+	{
+		free(file);
+		return NULL;
+	}
+
+	file->unz = z->unz;
+	*size = e->size;
+	return file;
+}
+
+// members are inflated straight into the caller's buffer, with nothing in between
+int archive_read(void *file, void *buffer, unsigned int len)
+{
+	archive_file *a = (archive_file *)file;
+
+	if (a->f) return fread(buffer, 1, len, a->f);
+	return unzReadCurrentFile(a->unz, buffer, len);
+}
+
+int archive_skip(void *file, unsigned int len)
+{
+	archive_file *a = (archive_file *)file;
+	char buffer[4096];
+	int r;
+
+	if (a->f) return fseek(a->f, len, SEEK_CUR);
+
+	while (len)
+	{
+		r = unzReadCurrentFile(a->unz, buffer, (len < sizeof(buffer)) ? len : sizeof(buffer));
+		if (r <= 0) return -1;
+		len -= r;
+	}
+	return 0;
+}
+
+void archive_close(void *file)
+{
+	archive_file *a = (archive_file *)file;
+
+	if (a->f) fclose(a->f);
+	else unzCloseCurrentFile(a->unz);
+	free(a);
+}
+
+int archive_list(const char *archive, int (*found)(const char *name, unsigned int size, void *ctx), void *ctx)
+{
+	zip_index *z = open_index(archive);
+	size_t i;
+
+	if (!z) return -1;
+
+	for (i = 0; i < z->entries.size(); i++)
+	{
+		if (found(z->entries[i].name.c_str(), z->entries[i].size, ctx)) break;
+	}
+
+	return 0;
+}
+
+int archive_readtag(void *psftag, const char *path)
+{
+	unsigned int size;
+	void *file;
+	char *data;
+	int r = -1;
+
+	if (!archive_split(path, NULL, NULL)) return psftag_readfromfile(psftag, path);
+
+	file = archive_open(path, &size);
+	if (!file) return -1;
+
+	data = (char *)malloc(size);
+	if (data && archive_read(file, data, size) == (int)size)
+	{
+		r = psftag_readfrommemory(psftag, data, size);
+	}
+
+	free(data);
+	archive_close(file);
+	return r;
+}
@@ -0,0 +1,36 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+// GSF sets kept as one .zip per game are addressed as if the archive were a directory,
+// e.g. /roms/music/GBA/Game.zip/01 Title.minigsf, so the _lib tags of a minigsf resolve
+// inside the same archive without any special casing. every call takes such a path;
+// plain files go to the filesystem as before
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// splits path into the archive and the member inside it, either of which may be NULL;
+// returns 0 if the path doesn't go through an archive. both buffers take PATH_MAX
+int archive_split(const char *path, char *archive, char *member);
+
+// whether the file or member can be read, like access(path, R_OK) == 0
+int archive_exists(const char *path);
+
+// opens a file or member to be read front to back, giving its size; NULL if it can't
+void *archive_open(const char *path, unsigned int *size);
+int archive_read(void *file, void *buffer, unsigned int len);
+int archive_skip(void *file, unsigned int len);
+void archive_close(void *file);
+
+// the members of an archive, in the order of the names; stops when found returns non-zero
+int archive_list(const char *archive, int (*found)(const char *name, unsigned int size, void *ctx), void *ctx);
+
+// psftag_readfromfile for any of the above
+int archive_readtag(void *psftag, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <vector>
+#include <zlib.h>
+
+#include "System.h"
+#include "archive.h"
+#include "lazyrom.h"
+
+int lazyromEnabled = 0;
+
+// the index, as kept in the cache: a header, then one checkpoint after another. a
+// checkpoint is where a deflate block starts, given in output and input bytes from the
+// start of the program and the bits of the byte before it that belong to the block,
+// along with the 32 KB of output before it that the block may refer back to
+
+#define LAZYROM_MAGIC		"GSFZIDX1"
+#define LAZYROM_WINDOW		32768
+#define LAZYROM_RESERVE		0x2000000	// all the ROM the GBA can address
+
+struct lazyrom_header
+{
+	char magic[8];
+	u64 filesize;
+	s64 mtime;
+	u32 offset;			// of the compressed program in the file
+	u32 program;		// its size
+	u32 crc;
+	u32 span;
+	u32 count;			// of checkpoints
+	u8 head[12];		// the first 12 bytes of output, the program's own header
+};
+
+struct lazyrom_point
+{
+	u32 out;
+	u32 in;
+	u32 bits;
+	u8 window[LAZYROM_WINDOW];
+};
+
+static int fd = -1;
+static unsigned int base;				// where the compressed program starts in the file
+static unsigned int compressed;
+static u8 *region;						// a header page and then the ROM
+static u32 romsize;
+static const lazyrom_header *header;
+static const lazyrom_point *points;
+static void *cache;						// the index, either mapped from the cache or built
+static size_t cachesize;
+static bool cachemapped;
+
+static z_stream strm;
+static u8 input[16384];
+static u8 discard[LAZYROM_WINDOW];
+
+static struct sigaction oldsegv;
+
+static bool page_fill(u32 page);
+
+// the ROM pages are PROT_NONE until touched; a fault in one is resolved by inflating
+// it and letting the access run again. anything else goes to whoever had it before,
+// as does a page that can't be inflated, rather than the emulator running on garbage
+static void lazyrom_fault(int sig, siginfo_t *info, void *context)
+{
+	static const char msg[] = "Can't inflate the ROM, the file may have changed\n";
+	u8 *addr = (u8 *)info->si_addr;
+
+	if (region && addr >= region + LAZYROM_PAGE && addr < region + LAZYROM_PAGE + LAZYROM_RESERVE)
+	{
+		if (page_fill((u32)(addr - region - LAZYROM_PAGE) / LAZYROM_PAGE)) return;
+		if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {}
+	}
+
+	sigaction(SIGSEGV, &oldsegv, NULL);
+}
+
+static bool page_fill(u32 page)
+{
+	u8 *dest = region + LAZYROM_PAGE + page * LAZYROM_PAGE;
+	u32 from = 12 + page * LAZYROM_PAGE;	// in output, past the program's header
+	u32 to = from + LAZYROM_PAGE;
+	u32 out, in;
+	const lazyrom_point *p;
+	int i, r;
+	u8 c;
+
+	if (mprotect(dest, LAZYROM_PAGE, PROT_READ | PROT_WRITE)) return false;
+
+	// past the end of the program is only ever zero, which the mapping already is
+	if (from >= romsize + 12) return true;
+	if (to > romsize + 12) to = romsize + 12;
+
+	for (i = header->count - 1; i > 0 && points[i].out > from; i--)
+	{
+	}
+	p = &points[i];
+
+	inflateReset(&strm);
+	if (p->bits)
+	{
+		if (pread(fd, &c, 1, base + p->in - 1) != 1) goto fail;
+		if (inflatePrime(&strm, p->bits, c >> (8 - p->bits)) != Z_OK) goto fail;
+	}
+	if (p->out && inflateSetDictionary(&strm, p->window, LAZYROM_WINDOW) != Z_OK) goto fail;
+
+	out = p->out;
+	in = p->in;
+	strm.avail_in = 0;
+
+	while (out < to)
+	{
+		if (!strm.avail_in)
+		{
+			r = pread(fd, input, (compressed - in < sizeof(input)) ? compressed - in : sizeof(input), base + in);
+			if (r <= 0) break;
+			in += r;
+			strm.next_in = input;
+			strm.avail_in = r;
+		}
+
+		// up to the page, through the scratch buffer, then straight into it
+		if (out < from)
+		{
+			strm.next_out = discard;
+			strm.avail_out = (from - out < sizeof(discard)) ? from - out : sizeof(discard);
+		}
+		else
+		{
+			strm.next_out = dest + (out - from);
+			strm.avail_out = to - out;
+		}
+
+		u32 avail = strm.avail_out;
+		r = inflate(&strm, Z_NO_FLUSH);
+		out += avail - strm.avail_out;
+
+		if (r != Z_OK) break;
+	}
+
+	if (out >= to) return true;
+
+	// so the access faults again, into the handler before this one
+fail:
+	mprotect(dest, LAZYROM_PAGE, PROT_NONE);
+	return false;
+}
+
+// zran: inflate the whole stream once, noting a checkpoint at the first block boundary
+// past every span of output
+static void *build_index(unsigned int *crc_out, size_t *size)
+{
+	std::vector<u8> idx(sizeof(lazyrom_header));
+	lazyrom_header h;
+	u8 window[LAZYROM_WINDOW];
+	z_stream s;
+	u32 totin = 0, totout = 0, last = 0, in = 0, crc = crc32(0L, Z_NULL, 0);
+	int r = Z_OK;
+	bool gothead = false;
+	void *result;
+
+	memset(&h, 0, sizeof(h));
+	memset(&s, 0, sizeof(s));
+	if (inflateInit(&s) != Z_OK) return NULL;
+
+	s.avail_out = 0;
+	while (r != Z_STREAM_END)
+	{
+		if (!s.avail_in)
+		{
+			int n = pread(fd, input, (compressed - in < sizeof(input)) ? compressed - in : sizeof(input), base + in);
+			if (n <= 0) break;
+			crc = crc32(crc, input, n);
+			in += n;
+			s.next_in = input;
+			s.avail_in = n;
+		}
+
+		do
+		{
+			if (!s.avail_out)
+			{
+				s.next_out = window;
+				s.avail_out = LAZYROM_WINDOW;
+			}
+
+			totin += s.avail_in;
+			totout += s.avail_out;
+			r = inflate(&s, Z_BLOCK);
+			totin -= s.avail_in;
+			totout -= s.avail_out;
+
+			if (r != Z_OK && r != Z_STREAM_END) break;
+
+			// the first fill of the window starts at the start of the output
+			if (!gothead && totout >= 12)
+			{
+				memcpy(h.head, window, 12);
+				gothead = true;
+			}
+
+			if ((s.data_type & 128) && !(s.data_type & 64) && (totout == 0 || totout - last > LAZYROM_SPAN))
+			{
+				size_t at = idx.size();
+				lazyrom_point *p;
+				u32 left = s.avail_out;
+
+				idx.resize(at + sizeof(lazyrom_point));
+				p = (lazyrom_point *)&idx[at];
+				p->out = totout;
+				p->in = totin;
+				p->bits = s.data_type & 7;
+				if (left) memcpy(p->window, window + LAZYROM_WINDOW - left, left);
+				if (left < LAZYROM_WINDOW) memcpy(p->window + left, window, LAZYROM_WINDOW - left);
+
+				h.count++;
+				last = totout;
+			}
+		} while (s.avail_in && r != Z_STREAM_END);
+
+		if (r != Z_OK && r != Z_STREAM_END) break;
+	}
+
+	inflateEnd(&s);
+	if (r != Z_STREAM_END || !h.count) return NULL;
+
+	// the rest of the file, if any, still counts towards the crc
+	while (in < compressed)
+	{
+		int n = pread(fd, input, (compressed - in < sizeof(input)) ? compressed - in : sizeof(input), base + in);
+		if (n <= 0) break;
+		crc = crc32(crc, input, n);
+		in += n;
+	}
+
+	memcpy(h.magic, LAZYROM_MAGIC, sizeof(h.magic));
+	h.span = LAZYROM_SPAN;
+	h.crc = crc;
+	memcpy(&idx[0], &h, sizeof(h));
+
+	result = malloc(idx.size());
+	if (!result) return NULL;
+	memcpy(result, &idx[0], idx.size());
+
+	*crc_out = crc;
+	*size = idx.size();
+	return result;
+}
+
+// the index of a library lives in $HOME/.cache/playgsf, named after the file
+static void cache_path(const char *file, char *path)
+{
+	char real[PATH_MAX];
+	const char *home = getenv("HOME");
+	u64 hash = 14695981039346656037ULL;
+	const char *p;
+
+	if (!realpath(file, real)) snprintf(real, sizeof(real), "%s", file);
+	for (p = real; *p; p++)
+	{
+		hash = (hash ^ (u8)*p) * 1099511628211ULL;
+	}
+
+	snprintf(path, PATH_MAX, "%s/.cache/playgsf/%016llx.zidx", home ? home : "/tmp", (unsigned long long)hash);
+}
+
+static void cache_mkdir(const char *path)
+{
+	char dir[PATH_MAX];
+	char *p;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (p = dir + 1; *p; p++)
+	{
+		if (*p != '/') continue;
+		*p = 0;
+		mkdir(dir, 0755);
+		*p = '/';
+	}
+}
+
+bool lazyrom_possible(const char *file, unsigned int program)
+{
+	// only a plain file can be read at random
+	return lazyromEnabled && program >= LAZYROM_MIN && !archive_split(file, NULL, NULL);
+}
+
+unsigned char *lazyrom_open(const char *file, unsigned int offset, unsigned int program, unsigned int crc)
+{
+	char path[PATH_MAX], temp[PATH_MAX + 8];
+	struct stat st;
+	struct sigaction sa;
+	const lazyrom_header *h;
+	unsigned int built_crc;
+	int cfd;
+
+	lazyrom_close();
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st)) goto fail;
+
+	base = offset;
+	compressed = program;
+
+	// a cached index is only taken if it was made from this very file
+	cache_path(file, path);
+	cfd = open(path, O_RDONLY);
+	if (cfd >= 0)
+	{
+		struct stat cst;
+
+		if (!fstat(cfd, &cst) && (size_t)cst.st_size >= sizeof(lazyrom_header))
+		{
+			cache = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, cfd, 0);
+			if (cache == MAP_FAILED) cache = NULL;
+			cachesize = cst.st_size;
+			cachemapped = cache != NULL;
+		}
+		close(cfd);
+
+		h = (const lazyrom_header *)cache;
+		if (h && (memcmp(h->magic, LAZYROM_MAGIC, sizeof(h->magic)) || h->filesize != (u64)st.st_size ||
+		          h->mtime != (s64)st.st_mtime || h->offset != offset || h->program != program || h->crc != crc ||
+		          h->span != LAZYROM_SPAN || cachesize != sizeof(lazyrom_header) + h->count * sizeof(lazyrom_point)))
+		{
+			munmap(cache, cachesize);
+			cache = NULL;
+			cachemapped = false;
+		}
+	}
+
+	if (!cache)
+	{
+		cache = build_index(&built_crc, &cachesize);
+		if (!cache) goto fail;
+		if (built_crc != crc)
+		{
+			fprintf(stderr, "Bad crc\n");
+			goto fail;
+		}
+
+		lazyrom_header *nh = (lazyrom_header *)cache;
+		nh->filesize = st.st_size;
+		nh->mtime = st.st_mtime;
+		nh->offset = offset;
+		nh->program = program;
+
+		// written aside and renamed into place, so no other player maps half of it
+		cache_mkdir(path);
+		snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+		cfd = mkstemp(temp);
+		if (cfd >= 0)
+		{
+			bool written = write(cfd, cache, cachesize) == (ssize_t)cachesize && !fchmod(cfd, 0644);
+			if (close(cfd) || !written || rename(temp, path)) unlink(temp);
+		}
+	}
+
+	header = (const lazyrom_header *)cache;
+	points = (const lazyrom_point *)(header + 1);
+	romsize = header->head[8] | (header->head[9] << 8) | (header->head[10] << 16) | (header->head[11] << 24);
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) goto fail;
+	// so the window is allocated now, rather than in the fault handler
+	inflateSetDictionary(&strm, points[0].window, 1);
+
+	region = (u8 *)mmap(NULL, LAZYROM_PAGE + LAZYROM_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+	{
+		region = NULL;
+		inflateEnd(&strm);
+		goto fail;
+	}
+	mprotect(region, LAZYROM_PAGE, PROT_READ | PROT_WRITE);
+	memcpy(region + LAZYROM_PAGE - 12, header->head, 12);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = lazyrom_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &oldsegv);
+
+	return region + LAZYROM_PAGE - 12;
+
+fail:
+	if (cache)
+	{
+		if (cachemapped) munmap(cache, cachesize);
+		else free(cache);
+		cache = NULL;
+	}
+	close(fd);
+	fd = -1;
+	return NULL;
+}
+
+bool lazyrom_owns(const void *p)
+{
+	return region && (const u8 *)p >= region && (const u8 *)p < region + LAZYROM_PAGE + LAZYROM_RESERVE;
+}
+
+void lazyrom_close(void)
+{
+	if (region)
+	{
+		sigaction(SIGSEGV, &oldsegv, NULL);
+		munmap(region, LAZYROM_PAGE + LAZYROM_RESERVE);
+		region = NULL;
+		inflateEnd(&strm);
+	}
+
+	if (cache)
+	{
+		if (cachemapped) munmap(cache, cachesize);
+		else free(cache);
+		cache = NULL;
+		cachemapped = false;
+	}
+
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
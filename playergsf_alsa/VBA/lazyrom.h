@@ -0,0 +1,27 @@
+#ifndef __LAZYROM_H__
+#define __LAZYROM_H__
+
+// most gsflibs carry the whole game, 8 to 16 MB of ROM, of which the sound driver only
+// reads its code and the samples it plays. with this on, a large library isn't inflated
+// when it is loaded: its ROM is reserved but left unmapped, and each 64 KB page is
+// inflated the first time the CPU, a DMA or the minigsf patch touches it, starting from
+// the nearest checkpoint of a zran-style index of the deflate stream. the index is made
+// by one full pass the first time a library is seen and cached on disk after that
+
+#define LAZYROM_PAGE		0x10000
+#define LAZYROM_SPAN		0x40000		// output between checkpoints of the index
+#define LAZYROM_MIN			0x40000		// smaller compressed programs are just inflated
+
+extern int lazyromEnabled;
+
+// called by decompressGSF with the compressed program at offset in file, its size and
+// crc; gives back the program as it would be inflated, the 12 byte header and then the
+// ROM, or NULL if it has to be loaded the usual way. one library is mapped at a time
+bool lazyrom_possible(const char *file, unsigned int program);
+unsigned char *lazyrom_open(const char *file, unsigned int offset, unsigned int program, unsigned int crc);
+
+// whether p points into the mapped program, and so has to go through lazyrom_close
+bool lazyrom_owns(const void *p);
+void lazyrom_close(void);
+
+#endif
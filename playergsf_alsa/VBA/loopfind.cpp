@@ -0,0 +1,172 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "System.h"
+#include "loopfind.h"
+
+// a window is the level in dB of the steps it covers, below LOOPFIND_SPLIT Hz and
+// above, once the DC the GBA's bias leaves in the mix is taken out. the levels of a
+// repeat are close but not the same: the direct sound's resampling is somewhere else,
+// and a loop is hardly ever a whole number of steps, so a window of the repeat can be
+// up to half a step off. windows overlap so that is a small part of one
+
+#define LOOPFIND_SPLIT		300.0
+#define LOOPFIND_QUIET		20.0	// dB; a window with both bands below is silent
+#define LOOPFIND_MATCH		1.5		// dB the bands are off by, on average, where it repeats
+#define LOOPFIND_SPAN		(LOOPFIND_STEPS / 2)	// steps that average is taken over
+#define LOOPFIND_SHORTEST	(2 * LOOPFIND_STEPS)	// the shortest loop
+#define LOOPFIND_ENDING		(5 * LOOPFIND_STEPS)	// the silence a track that ends ends with
+
+struct loopfind_window
+{
+	float low, high;
+};
+
+static std::vector<loopfind_window> windows;	// one a step, of the steps up to it
+static double steps[LOOPFIND_WINDOW][2];		// the energy of the last few, low and high
+static int step_frames;
+static int count;
+static float split;
+static float dc_in, dc_out, lows;
+
+void loopfind_start(int rate)
+{
+	windows.clear();
+	memset(steps, 0, sizeof(steps));
+	step_frames = rate / LOOPFIND_STEPS;
+	split = (float)(1.0 - exp(-2.0 * M_PI * LOOPFIND_SPLIT / rate));
+	count = 0;
+	dc_in = dc_out = lows = 0;
+}
+
+void loopfind_feed(const short * mix, int frames)
+{
+	for (int i = 0; i < frames; i++, mix += 2)
+	{
+		float x = (mix[0] + mix[1]) * 0.5f;
+		float y = x - dc_in + 0.999f * dc_out;
+
+		dc_in = x;
+		dc_out = y;
+		lows += (y - lows) * split;
+
+		double * step = steps[windows.size() % LOOPFIND_WINDOW];
+		step[0] += (double)lows * lows;
+		step[1] += (double)(y - lows) * (y - lows);
+
+		if (++count == step_frames)
+		{
+			loopfind_window w;
+			double low = 0, high = 0;
+
+			for (int k = 0; k < LOOPFIND_WINDOW; k++)
+			{
+				low += steps[k][0];
+				high += steps[k][1];
+			}
+			w.low = (float)(10.0 * log10(low / (LOOPFIND_WINDOW * step_frames) + 1.0));
+			w.high = (float)(10.0 * log10(high / (LOOPFIND_WINDOW * step_frames) + 1.0));
+			windows.push_back(w);
+
+			count = 0;
+			steps[windows.size() % LOOPFIND_WINDOW][0] = 0;
+			steps[windows.size() % LOOPFIND_WINDOW][1] = 0;
+		}
+	}
+}
+
+static bool quiet(int i)
+{
+	return windows[i].low < LOOPFIND_QUIET && windows[i].high < LOOPFIND_QUIET;
+}
+
+static double distance(int a, int b)
+{
+	return (fabs(windows[a].low - windows[b].low) + fabs(windows[a].high - windows[b].high)) * 0.5;
+}
+
+// the first window from which on the mix is what it was lag windows before, to the end
+// of what there is of it. walked back from the end, until the average of a span is off
+static int repeats_from(int lag)
+{
+	int n = (int)windows.size() - lag;
+	double sum = 0;
+	int j, from;
+
+	for (j = n - 1; j >= 0; j--)
+	{
+		sum += distance(j, j + lag);
+		if (j + LOOPFIND_SPAN < n) sum -= distance(j + LOOPFIND_SPAN, j + LOOPFIND_SPAN + lag);
+		if (n - j >= LOOPFIND_SPAN && sum > LOOPFIND_MATCH * LOOPFIND_SPAN) break;
+	}
+	if (j < 0) return 0;
+
+	// the break is in that span; the windows of it after the break still match
+	from = j + LOOPFIND_SPAN;
+	while (from > j && distance(from - 1, from - 1 + lag) <= LOOPFIND_MATCH) from--;
+	return from;
+}
+
+// how well the mix repeats at lag: the average distance from where it does, or -1 if
+// it doesn't for a whole loop, or only as the same silence
+static double repeats(int lag, int * from)
+{
+	int n = (int)windows.size();
+	int loud = 0;
+	double sum = 0;
+
+	*from = repeats_from(lag);
+	if (*from + 2 * lag > n) return -1;
+
+	for (int i = *from; i < n - lag; i++)
+	{
+		loud += !quiet(i);
+		sum += distance(i, i + lag);
+	}
+	if (loud * 2 < n - lag - *from) return -1;
+
+	return sum / (n - lag - *from);
+}
+
+int loopfind_find(loopfind_result * r)
+{
+	int n = (int)windows.size();
+	int end = n;
+
+	while (end > 0 && quiet(end - 1)) end--;
+	if (end > 0 && n - end >= LOOPFIND_ENDING)
+	{
+		// the first window all quiet starts that many steps before it is kept
+		r->intro = (long long)(end - LOOPFIND_WINDOW + 1) * step_frames;
+		r->loop = 0;
+		return LOOPFIND_ENDS;
+	}
+
+	// the shortest lag it repeats at, or one just after that it repeats at better; the
+	// loop's own length is where the levels line up closest
+	for (int lag = LOOPFIND_SHORTEST; 2 * lag <= n; lag++)
+	{
+		int from, best_from, best_lag = lag;
+		double best = repeats(lag, &best_from);
+
+		if (best < 0) continue;
+
+		for (int near = lag + 1; near <= lag + LOOPFIND_SPAN && 2 * near <= n; near++)
+		{
+			double d = repeats(near, &from);
+			if (d >= 0 && d < best)
+			{
+				best = d;
+				best_lag = near;
+				best_from = from;
+			}
+		}
+
+		r->intro = (long long)(best_from > LOOPFIND_WINDOW ? best_from - LOOPFIND_WINDOW + 1 : 0) * step_frames;
+		r->loop = (long long)best_lag * step_frames;
+		return LOOPFIND_LOOPS;
+	}
+
+	return LOOPFIND_NONE;
+}
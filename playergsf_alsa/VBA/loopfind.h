@@ -0,0 +1,36 @@
+#ifndef __LOOPFIND_H__
+#define __LOOPFIND_H__
+
+// where a track without a length tag loops, from its mix as it is rendered. every
+// 1/LOOPFIND_STEPS s, the last LOOPFIND_WINDOW steps of the mix are kept as how loud
+// their lows and their highs are, and the track loops at the shortest lag from which
+// on everything after some point sounds as it did that much earlier, for a whole loop
+// at least. a track that goes quiet for good ends there instead. positions are in
+// frames of the mix
+
+#define LOOPFIND_STEPS		160
+#define LOOPFIND_WINDOW		4
+
+enum
+{
+	LOOPFIND_NONE,			// not enough of the track yet to tell
+	LOOPFIND_LOOPS,
+	LOOPFIND_ENDS
+};
+
+struct loopfind_result
+{
+	long long intro;		// where the loop starts, or where a track that ends goes quiet
+	long long loop;			// how long the loop is, 0 if the track ends
+};
+
+// a new track, mixed at rate
+void loopfind_start(int rate);
+
+// frames of interleaved stereo from the mix
+void loopfind_feed(const short * mix, int frames);
+
+// what the mix so far says
+int loopfind_find(loopfind_result * r);
+
+#endif
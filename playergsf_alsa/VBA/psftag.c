@@ -195,10 +195,79 @@ static int find_tag_var_end(const char *tagbuffer) {
   }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+/*
+** One line of a tag
+** name_l is 0 if the line isn't a variable, i.e. has no '=' with a name before it
+** Neither the name nor the value include the whitespace around them
+*/
+struct tag_line {
+  const char *name;
+  int name_l;
+  const char *value;
+  int value_l;
+};
+
+/*
+** Reads the next line of the tag, past any blank ones
+** Returns where the line after it starts, or NULL if the tag has ended
+*/
+static const char *next_tag_line(const char *tag, struct tag_line *line) {
+  const unsigned char *p = (const unsigned char*)tag;
+  const unsigned char *eq = NULL;
+  const unsigned char *n, *v, *end;
+  /*
+  ** Find first non-whitespace
+  ** (this is the variable name on the current line)
+  */
+  while(*p && *p <= 0x20) p++;
+  if(!*p) return NULL;
+  line->name = (const char*)p;
+  /*
+  ** Find the first '=' and the newline or end-of-tag
+  */
+  for(; *p && *p != 0x0A; p++) {
+    if(!eq && *p == '=') eq = p;
+  }
+  end = p;
+  if(*p) p++;
+  line->name_l = 0;
+  line->value = (const char*)end;
+  line->value_l = 0;
+  if(!eq) return (const char*)p;
+  /*
+  ** Trim the name, and the value on both sides
+  */
+  for(n = eq; n > (const unsigned char*)line->name && n[-1] <= 0x20; n--) { }
+  for(v = eq + 1; v < end && *v <= 0x20; v++) { }
+  while(end > v && end[-1] <= 0x20) end--;
+  line->name_l = n - (const unsigned char*)line->name;
+  line->value = (const char*)v;
+  line->value_l = end - v;
+  return (const char*)p;
+}
+
+/*
+** Compare two names case-insensitively
+*/
+static int tag_name_equal(const char *a, int a_l, const char *b, int b_l) {
+  int j;
+  if(a_l != b_l) return 0;
+  for(j = 0; j < a_l; j++) {
+    unsigned ua = ((unsigned)(a[j])) & 0xFF;
+    unsigned ub = ((unsigned)(b[j])) & 0xFF;
+    if(ua >= 'A' && ua <= 'Z') { ua -= 'A'; ua += 'a'; }
+    if(ub >= 'A' && ub <= 'Z') { ub -= 'A'; ub += 'a'; }
+    if(ua != ub) return 0;
+  }
+  return 1;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 /*
 ** Get tag variable
-** The destination value buffer must be as big as the entire tag
+** A variable goes on for as many lines in a row as have its name, which
+** are joined with newlines; only the first time it appears counts
 */
 int psftag_raw_getvar(
   const char *tag,
@@ -206,10 +275,11 @@ int psftag_raw_getvar(
   char *value_out,
   int value_out_size
 ) {
+  struct tag_line line;
   char *v = value_out;
-  char *vmax = v + value_out_size;
-  char *v_linebegin;
-  int i, i_end;
+  char *vmax = v + value_out_size - 1;
+  int variable_l;
+  int found = 0;
   //
   // Safety check
   //
@@ -218,63 +288,115 @@ int psftag_raw_getvar(
   ** Default to empty string
   */
   *v = 0;
+  if(!tag || !variable) return -1;
+  variable_l = strlen(variable);
   /*
-  ** Find the variable start/end index
+  ** Find the first line of the variable, then take lines up to one that isn't
   */
-  i = find_tag_var_start(tag, variable);
-  if(i < 0) return -1;
-  i_end = i + find_tag_var_end(tag + i);
-  /*
-  ** Extract the variable data
-  */
-  while(i < i_end) {
-    /*
-    ** Skip to first '='
-    */
-    while((tag[i] != '=') && (i < i_end)) { i++; }
-    if(i >= i_end) break;
-    /*
-    ** If this is not the first line, add a newline
-    */
-    if(v > value_out) { 
-      if(v < vmax) { *v++ = 0x0A; }
+  while((tag = next_tag_line(tag, &line)) != NULL) {
+    int l;
+    if(!line.name_l || !tag_name_equal(line.name, line.name_l, variable, variable_l)) {
+      if(found) break;
+      continue;
     }
     /*
-    ** Now that we're at a '=', skip past it
-    */
-    i++;
-    if(i >= i_end) break;
-    /*
-    ** Skip past any whitespace except newlines
+    ** If this is not the first line, add a newline
     */
-    for(; i < i_end; i++) {
-      unsigned u = ((unsigned)(tag[i])) & 0xFF;
-      if(u == 0x0A) break;
-      if(u <= 0x20) continue;
-      break;
+    if(v > value_out && v < vmax) { *v++ = 0x0A; }
+    found = 1;
+    l = line.value_l;
+    if(l > vmax - v) l = vmax - v;
+    memcpy(v, line.value, l);
+    v += l;
+  }
+  /*
+  ** Set variable end
+  */
+  *v = 0;
+  return found ? 0 : -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static const char *table_find(const struct psftag_table *table, const char *variable, int variable_l) {
+  int i;
+  for(i = 0; i < table->count; i++) {
+    const char *name = table->strings + table->vars[i].name;
+    if(tag_name_equal(name, strlen(name), variable, variable_l)) return table->strings + table->vars[i].value;
+  }
+  return NULL;
+}
+
+/*
+** Parse a whole tag in one pass, by the same rules as psftag_raw_getvar
+** Names and values go one after the other into strings; the value being
+** read is always the last thing there, so its next line is just appended
+*/
+void psftag_parse(struct psftag_table *table, const char *tag) {
+  struct tag_line line;
+  const char *last = NULL;  /* name of the previous line, if it was a variable */
+  int last_l = 0;
+  int keeping = 0;          /* whether the previous line went into the table */
+  char *s = table->strings;
+  char *smax = s + sizeof(table->strings) - 1;
+
+  table->count = 0;
+  *s = 0;
+  if(!tag) return;
+
+  while((tag = next_tag_line(tag, &line)) != NULL) {
+    int l;
+    if(!line.name_l) {
+      last = NULL;
+      continue;
     }
-    if(i >= i_end) break;
     /*
-    ** Consume line data
+    ** Another line of the variable before
     */
-    v_linebegin = v;
-    while(i < i_end) {
-      unsigned u = ((unsigned)(tag[i++])) & 0xFF;
-      if(u == 0x0A) break;
-      if(v < vmax) { *v++ = u; }
-    }
+    if(last && tag_name_equal(line.name, line.name_l, last, last_l)) {
+      if(!keeping) continue;
+      if(s > table->strings + table->vars[table->count - 1].value && s < smax) { *s++ = 0x0A; }
     /*
-    ** Eat end-of-line whitespace
+    ** Otherwise a new variable, unless it's already been seen or there's no room
     */
-    while(v > v_linebegin && (((unsigned)(v[-1]))&0xFF) <= 0x20) {
-      v--;
+    } else {
+      last = line.name;
+      last_l = line.name_l;
+      keeping = 0;
+      if(table_find(table, line.name, line.name_l)) continue;
+      if(table->count >= PSFTAG_TABLE_VARS || smax - s < line.name_l + 2) continue;
+      keeping = 1;
+      /* past the end of the value before */
+      if(table->count) s++;
+      table->vars[table->count].name = s - table->strings;
+      memcpy(s, line.name, line.name_l);
+      s += line.name_l;
+      *s++ = 0;
+      table->vars[table->count].value = s - table->strings;
+      table->count++;
     }
+    l = line.value_l;
+    if(l > smax - s) l = smax - s;
+    memcpy(s, line.value, l);
+    s += l;
+    *s = 0;
   }
-  /*
-  ** Set variable end
-  */
-  if(v >= vmax) { v = vmax - 1; }
-  *v = 0;
+}
+
+const char *psftag_table_find(const struct psftag_table *table, const char *variable) {
+  return table_find(table, variable, strlen(variable));
+}
+
+int psftag_table_getvar(const struct psftag_table *table, const char *variable, char *value_out, int value_out_size) {
+  const char *value;
+  if(value_out_size < 1) return -1;
+  value = psftag_table_find(table, variable);
+  if(!value) {
+    *value_out = 0;
+    return -1;
+  }
+  strncpy(value_out, value, value_out_size);
+  value_out[value_out_size - 1] = 0;
   return 0;
 }
 
@@ -501,6 +623,44 @@ error:
 
 /////////////////////////////////////////////////////////////////////////////
 
+int psftag_readfrommemory(void *psftag, const void *data, int size) {
+  struct PSFTAG *t = (struct PSFTAG*)psftag;
+  const unsigned char *hdr = (const unsigned char*)data;
+  int l;
+  unsigned rsize, exesize, tagstart;
+
+  if(size < 16) return -1;
+  if(memcmp(hdr, "PSF", 3)) return -1;
+
+  rsize =
+    (((unsigned)(hdr[ 4])) <<  0) |
+    (((unsigned)(hdr[ 5])) <<  8) |
+    (((unsigned)(hdr[ 6])) << 16) |
+    (((unsigned)(hdr[ 7])) << 24);
+  exesize =
+    (((unsigned)(hdr[ 8])) <<  0) |
+    (((unsigned)(hdr[ 9])) <<  8) |
+    (((unsigned)(hdr[10])) << 16) |
+    (((unsigned)(hdr[11])) << 24);
+
+  if(rsize > (unsigned)size || exesize > (unsigned)size) return -1;
+  tagstart = 16 + rsize + exesize;
+
+  if(tagstart + 5 > (unsigned)size) return -1;
+  if(memcmp(hdr + tagstart, "[TAG]", 5)) return -1;
+
+  tagstart += 5;
+  l = size - tagstart;
+  if(l > TAGMAX) l = TAGMAX;
+
+  memset(t->str, 0, TAGMAX + 1);
+  memcpy(t->str, hdr + tagstart, l);
+
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 int psftag_writetofile(void *psftag, const char *path) {
   struct PSFTAG *t = (struct PSFTAG*)psftag;
   FILE *f = NULL;
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <vector>
+#include <algorithm>
+
+#include "System.h"
+#include "archive.h"
+#include "shmrom.h"
+
+const char *shmromDir = "/dev/shm";
+
+// a cached library is its header, then the program as inflated, placed so the ROM after
+// its own 12 byte header starts on a page. the file is named after the user and the
+// library's path, so a library that changes on disk replaces its own entry
+
+#define SHMROM_MAGIC		"GSFSHM01"
+#define SHMROM_RESERVE		0x2000000	// all the ROM the GBA can address
+#define SHMROM_BUDGET		0x6000000	// of a user's libraries kept at once, tmpfs being RAM
+
+struct shmrom_header
+{
+	char magic[8];
+	u64 dev;			// of the file, or of the archive it is in
+	u64 ino;
+	u64 filesize;
+	s64 mtime;
+	u32 reserved;
+	u32 program;		// the compressed size
+	u32 crc;
+	u32 size;			// of the program inflated, header included
+};
+
+static u8 *region;		// the mapped file, then zeroes up to the end of the ROM
+
+// the cache file of a library, and what it has to have been made from
+static bool identify(const char *file, shmrom_header *h, char *path)
+{
+	char archive[PATH_MAX], member[PATH_MAX], real[PATH_MAX];
+	struct stat st;
+	u64 hash = 14695981039346656037ULL;
+	const char *p;
+
+	if (!shmromDir || !*shmromDir) return false;
+
+	if (archive_split(file, archive, member))
+	{
+		if (!realpath(archive, real)) return false;
+		if (strlen(real) + strlen(member) + 2 > sizeof(real)) return false;
+		strcat(real, "/");
+		strcat(real, member);
+	}
+	else
+	{
+		if (!realpath(file, real)) return false;
+		strcpy(archive, real);
+	}
+
+	if (stat(archive, &st)) return false;
+
+	for (p = real; *p; p++)
+	{
+		hash = (hash ^ (u8)*p) * 1099511628211ULL;
+	}
+
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, SHMROM_MAGIC, sizeof(h->magic));
+	h->dev = st.st_dev;
+	h->ino = st.st_ino;
+	h->filesize = st.st_size;
+	h->mtime = st.st_mtime;
+
+	snprintf(path, PATH_MAX, "%s/playgsf-%u-%016llx.rom", shmromDir, (unsigned)getuid(), (unsigned long long)hash);
+	return true;
+}
+
+struct shmrom_entry
+{
+	time_t used;
+	off_t size;
+	char path[PATH_MAX];
+};
+
+// the libraries last used go first when there would be more than SHMROM_BUDGET of them
+// with size more. one a player still has mapped stays in its memory until it is done
+static void evict(const char *keep, off_t size)
+{
+	char prefix[64], path[PATH_MAX];
+	std::vector<shmrom_entry> entries;
+	struct dirent *de;
+	struct stat st;
+	off_t total = size;
+	DIR *dir;
+
+	dir = opendir(shmromDir);
+	if (!dir) return;
+
+	snprintf(prefix, sizeof(prefix), "playgsf-%u-", (unsigned)getuid());
+	while ((de = readdir(dir)))
+	{
+		size_t len = strlen(de->d_name);
+
+		if (strncmp(de->d_name, prefix, strlen(prefix)) || len < 4 || strcmp(de->d_name + len - 4, ".rom")) continue;
+		if (snprintf(path, sizeof(path), "%s/%s", shmromDir, de->d_name) >= (int)sizeof(path)) continue;
+		if (!strcmp(path, keep) || stat(path, &st) || st.st_uid != getuid()) continue;
+
+		shmrom_entry e;
+		e.used = st.st_mtime;
+		e.size = st.st_size;
+		strcpy(e.path, path);
+		entries.push_back(e);
+		total += st.st_size;
+	}
+	closedir(dir);
+
+	std::sort(entries.begin(), entries.end(),
+	          [](const shmrom_entry &a, const shmrom_entry &b) { return a.used < b.used; });
+	for (size_t i = 0; i < entries.size() && total > SHMROM_BUDGET; i++)
+	{
+		if (!unlink(entries[i].path)) total -= entries[i].size;
+	}
+}
+
+// the ROM is reserved in full and the file mapped over the start of it, so reads past
+// the end of the program give zero as they would from a buffer of the usual size
+static u8 *map(int fd, size_t len)
+{
+	u8 *r;
+
+	r = (u8 *)mmap(NULL, SHMROM_HEAD + SHMROM_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) return NULL;
+
+	if (mmap(r, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(r, SHMROM_HEAD + SHMROM_RESERVE);
+		return NULL;
+	}
+
+	region = r;
+	return region + SHMROM_HEAD - 12;
+}
+
+unsigned char *shmrom_open(const char *file, unsigned int reserved, unsigned int program, unsigned int crc)
+{
+	char path[PATH_MAX];
+	shmrom_header want, h;
+	struct stat st;
+	u8 *result = NULL;
+	int fd;
+
+	shmrom_close();
+
+	if (!identify(file, &want, path)) return NULL;
+	want.reserved = reserved;
+	want.program = program;
+	want.crc = crc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	// only what this user put there, and only if it was made from this very file
+	if (!fstat(fd, &st) && st.st_uid == getuid() && pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h))
+	{
+		want.size = h.size;
+		if (!memcmp(&h, &want, sizeof(h)) && h.size >= 12 && h.size - 12 <= SHMROM_RESERVE &&
+		    (u64)st.st_size == (u64)SHMROM_HEAD - 12 + h.size)
+		{
+			result = map(fd, st.st_size);
+			// its mtime is when it was last used, for evict
+			if (result) futimens(fd, NULL);
+		}
+	}
+
+	close(fd);
+	return result;
+}
+
+unsigned char *shmrom_store(const char *file, unsigned int reserved, unsigned int program, unsigned int crc,
+                            const unsigned char *image, unsigned int size)
+{
+	char path[PATH_MAX], temp[PATH_MAX + 8];
+	shmrom_header h;
+	size_t len = SHMROM_HEAD - 12 + size;
+	u8 *result = NULL;
+	int fd;
+
+	shmrom_close();
+
+	if (size < 12 || size - 12 > SHMROM_RESERVE) return NULL;
+	if (!identify(file, &h, path)) return NULL;
+	h.reserved = reserved;
+	h.program = program;
+	h.crc = crc;
+	h.size = size;
+
+	evict(path, len);
+
+	// written aside and renamed into place, so no one ever maps half of it
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+	fd = mkstemp(temp);
+	if (fd < 0) return NULL;
+
+	if (ftruncate(fd, len) || pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+	    pwrite(fd, image, size, SHMROM_HEAD - 12) != (ssize_t)size || rename(temp, path))
+	{
+		unlink(temp);
+		close(fd);
+		return NULL;
+	}
+
+	result = map(fd, len);
+	close(fd);
+	return result;
+}
+
+bool shmrom_owns(const void *p)
+{
+	return region && (const u8 *)p >= region && (const u8 *)p < region + SHMROM_HEAD + SHMROM_RESERVE;
+}
+
+void shmrom_close(void)
+{
+	if (region)
+	{
+		munmap(region, SHMROM_HEAD + SHMROM_RESERVE);
+		region = NULL;
+	}
+}
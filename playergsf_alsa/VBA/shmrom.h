@@ -0,0 +1,28 @@
+#ifndef __SHMROM_H__
+#define __SHMROM_H__
+
+// every track the selector starts is a new process that would inflate the same gsflib
+// again. instead, the first one to inflate a library leaves the image, already checked
+// against its crc, in a file on a tmpfs (/dev/shm unless -M says otherwise), and the
+// ones after it map that file. the mapping is private, so the minigsf patch and any
+// write to ROM only copy the pages they touch, and every player running at once reads
+// the same physical pages for the rest. the ones used longest ago make way when a
+// user's would take more than SHMROM_BUDGET of the tmpfs's memory
+
+#define SHMROM_HEAD			0x1000		// the file's header, before the program
+
+extern const char *shmromDir;
+
+// gives back the main library of file as decompressGSF would, the 12 byte header and
+// then the ROM, if the cache has it for this very file, or NULL
+unsigned char *shmrom_open(const char *file, unsigned int reserved, unsigned int program, unsigned int crc);
+
+// puts an inflated library in the cache and maps it in its place; NULL if it can't, in
+// which case image stays the caller's. one library is mapped at a time
+unsigned char *shmrom_store(const char *file, unsigned int reserved, unsigned int program, unsigned int crc,
+                            const unsigned char *image, unsigned int size);
+
+bool shmrom_owns(const void *p);
+void shmrom_close(void);
+
+#endif
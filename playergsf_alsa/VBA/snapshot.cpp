@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <vector>
+
+#include "GBA.h"
+#include "Globals.h"
+#include "archive.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_STATE		0x4000		// room for CPUWriteMemState
+
+struct keyframe
+{
+	long long position;
+	std::vector<char> state;
+	std::vector<u32> pages;		// where in the arena each page that differs starts
+	std::vector<u8> data;		// and those pages, one after the other
+};
+
+static std::vector<keyframe> keyframes;
+static u8 *base;				// the arena as it was at the first keyframe
+static int base_size;
+static size_t used;
+
+void snapshot_clear(void)
+{
+	keyframes.clear();
+	used = 0;
+}
+
+bool snapshot_take(long long position)
+{
+	static char state[SNAPSHOT_STATE];
+	int size, n;
+	u8 *arena = CPUArena(&size);
+
+	if (!arena || used > SNAPSHOT_BUDGET) return false;
+	if (!keyframes.empty() && position <= keyframes.back().position) return false;
+
+	n = CPUWriteMemState(state, sizeof(state));
+	if (!n) return false;
+
+	if (keyframes.empty() && size != base_size)
+	{
+		free(base);
+		base = (u8 *)malloc(size);
+		base_size = base ? size : 0;
+		if (!base) return false;
+	}
+
+	keyframes.push_back(keyframe());
+	keyframe & k = keyframes.back();
+	k.position = position;
+	k.state.assign(state, state + n);
+
+	if (keyframes.size() == 1)
+	{
+		memcpy(base, arena, size);
+		used += size;
+	}
+	else
+	{
+		for (int at = 0; at + SNAPSHOT_PAGE <= size; at += SNAPSHOT_PAGE)
+		{
+			if (memcmp(arena + at, base + at, SNAPSHOT_PAGE))
+			{
+				k.pages.push_back(at);
+				k.data.insert(k.data.end(), arena + at, arena + at + SNAPSHOT_PAGE);
+			}
+		}
+	}
+
+	used += n + k.pages.size() * (sizeof(u32) + SNAPSHOT_PAGE);
+	return true;
+}
+
+long long snapshot_last(void)
+{
+	return keyframes.empty() ? -1 : keyframes.back().position;
+}
+
+// the machine as it was before a state that didn't read, which can have been read in
+// part: the arena and a state of its own, to be put back
+
+static std::vector<u8> held_arena;
+static char held_state[SNAPSHOT_STATE];
+static int held_size;
+
+static bool hold(u8 *arena, int size)
+{
+	held_size = CPUWriteMemState(held_state, sizeof(held_state));
+	if (!held_size) return false;
+	held_arena.assign(arena, arena + size);
+	return true;
+}
+
+static void put_back(u8 *arena, int size)
+{
+	memcpy(arena, &held_arena[0], size);
+	CPUReadMemState(held_state, held_size);
+}
+
+static keyframe * find(long long position)
+{
+	int lo = 0, hi = (int)keyframes.size();
+
+	// the first keyframe past position, then the one before it
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (keyframes[mid].position <= position) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo ? &keyframes[lo - 1] : NULL;
+}
+
+long long snapshot_find(long long position)
+{
+	keyframe * k = find(position);
+	return k ? k->position : -1;
+}
+
+long long snapshot_restore(long long position)
+{
+	keyframe * k = find(position);
+	int size;
+	u8 *arena = CPUArena(&size);
+
+	if (!k || !arena || size != base_size || !hold(arena, size)) return -1;
+
+	memcpy(arena, base, size);
+	for (size_t i = 0; i < k->pages.size(); i++)
+	{
+		memcpy(arena + k->pages[i], &k->data[i * SNAPSHOT_PAGE], SNAPSHOT_PAGE);
+	}
+
+	// -1 leaves the machine where it was, for the caller to go on from
+	if (!CPUReadMemState(&k->state[0], (int)k->state.size()))
+	{
+		put_back(arena, size);
+		return -1;
+	}
+	return k->position;
+}
+
+// a saved machine is its header, the arena and then the state
+
+#define SNAPSHOT_MAGIC		"GSFSNP01"
+
+struct snapshot_header
+{
+	char magic[8];
+	u64 path;			// a hash of where the track is
+	u64 dev;			// of the file, or of the archive it is in
+	u64 ino;
+	u64 filesize;
+	s64 mtime;
+	u8 romname[16];		// as the VBA save states had it, if there is a ROM
+	s64 position;
+	u32 rate;
+	u32 arena;
+	u32 state;
+	u32 crc;			// of the arena and the state
+};
+
+// what a file for track has to say it was made from, besides what it holds
+static bool identify(const char *track, snapshot_header *h)
+{
+	char archive[PATH_MAX], member[PATH_MAX], real[PATH_MAX];
+	struct stat st;
+	u64 hash = 14695981039346656037ULL;
+	const char *p;
+
+	if (archive_split(track, archive, member))
+	{
+		if (!realpath(archive, real)) return false;
+		if (strlen(real) + strlen(member) + 2 > sizeof(real)) return false;
+		strcat(real, "/");
+		strcat(real, member);
+	}
+	else
+	{
+		if (!realpath(track, real)) return false;
+		strcpy(archive, real);
+	}
+
+	if (stat(archive, &st)) return false;
+
+	for (p = real; *p; p++)
+	{
+		hash = (hash ^ (u8)*p) * 1099511628211ULL;
+	}
+
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+	h->path = hash;
+	h->dev = st.st_dev;
+	h->ino = st.st_ino;
+	h->filesize = st.st_size;
+	h->mtime = st.st_mtime;
+	if (rom && !cpuIsMultiBoot) memcpy(h->romname, &rom[0xa0], sizeof(h->romname));
+	return true;
+}
+
+bool snapshot_save(const char *path, const char *track, long long position, int rate)
+{
+	static char state[SNAPSHOT_STATE];
+	char temp[PATH_MAX + 8];
+	snapshot_header h;
+	int size, n, fd;
+	bool ok;
+	u8 *arena = CPUArena(&size);
+
+	if (!arena || !identify(track, &h)) return false;
+
+	n = CPUWriteMemState(state, sizeof(state));
+	if (!n) return false;
+
+	h.position = position;
+	h.rate = rate;
+	h.arena = size;
+	h.state = n;
+	h.crc = crc32(crc32(0, arena, size), (const Bytef *)state, n);
+
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+	fd = mkstemp(temp);
+	if (fd < 0) return false;
+
+	ok = write(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) && write(fd, arena, size) == (ssize_t)size &&
+	     write(fd, state, n) == (ssize_t)n && !fsync(fd);
+	// closed once, whatever happened; the name is only taken once it is all there
+	if (close(fd) || !ok || rename(temp, path))
+	{
+		unlink(temp);
+		return false;
+	}
+	return true;
+}
+
+long long snapshot_load(const char *path, const char *track, int rate)
+{
+	snapshot_header want, h;
+	std::vector<u8> image;
+	long long result = -1;
+	int size, fd;
+	u8 *arena = CPUArena(&size);
+
+	if (!arena || !identify(track, &want)) return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if (read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) && !memcmp(&h, &want, offsetof(snapshot_header, position)) &&
+	    h.rate > 0 && h.arena == (u32)size && h.state <= SNAPSHOT_STATE)
+	{
+		// read whole and checked before any of it goes into the machine
+		image.resize(h.arena + h.state);
+		if (read(fd, &image[0], image.size()) == (ssize_t)image.size() &&
+		    crc32(0, &image[0], image.size()) == h.crc && hold(arena, size))
+		{
+			memcpy(arena, &image[0], size);
+			if (CPUReadMemState((char *)&image[size], h.state))
+			{
+				result = h.position * rate / h.rate;
+			}
+			else
+			{
+				put_back(arena, size);
+			}
+		}
+	}
+
+	close(fd);
+	return result;
+}
@@ -0,0 +1,39 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+// keyframes of the track playing, for seeking back without starting it over. each is
+// the state CPUWriteMemState leaves and, of the memory, only the pages that differ
+// from the first keyframe, which is kept whole. bringing one back is the same three
+// copies however far into the track it is. positions are the caller's and go up from
+// one keyframe to the next
+
+#define SNAPSHOT_PAGE		0x400
+#define SNAPSHOT_BUDGET		(32 << 20)	// no keyframes are taken past this much
+
+// forgets them all, for a new track
+void snapshot_clear(void);
+
+// a keyframe of the machine as it is now; false if there is no room for it, or it
+// isn't past the last one
+bool snapshot_take(long long position);
+
+// the position of the last keyframe, or -1 if there is none yet
+long long snapshot_last(void);
+
+// the position of the last keyframe at or before position, or -1
+long long snapshot_find(long long position);
+
+// puts the machine back as it was at the keyframe snapshot_find gives; its position,
+// or -1 if there is none or it won't read, the machine as it was
+long long snapshot_restore(long long position);
+
+// the machine as it is now and its position, at rate, in a file that a later player
+// can start track from with snapshot_load. the file is written aside and renamed into
+// place, so it is the last one whole or the one before
+bool snapshot_save(const char *path, const char *track, long long position, int rate);
+
+// puts the machine back from a file snapshot_save made from this very track, as it is
+// on disk now, and gives the position there at rate; -1 if it can't, the machine as it was
+long long snapshot_load(const char *path, const char *track, int rate);
+
+#endif
@@ -0,0 +1,354 @@
+#include <math.h>
+#include <string.h>
+
+#include "System.h"
+#include "snd_dsp.h"
+
+#if !defined(NO_SIMD) && defined(__SSE4_1__)
+#include <smmintrin.h>
+#define DSP_SSE41
+#elif !defined(NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DSP_NEON
+#endif
+
+// samples run through the filters with DSP_EXTRA_BITS more than the mix has, so the
+// low shelf's long tail isn't lost to rounding; coefficients have DSP_COEF_BITS of
+// fraction, enough up to +-8, and the gain 16. a stage sums into 64 bits
+
+#define DSP_EXTRA_BITS		8
+#define DSP_COEF_BITS		28
+#define DSP_GAIN_BITS		16
+
+#define DSP_BASS_FREQ		250.0
+#define DSP_BASS_GAIN		5.0
+#define DSP_MAX_GAIN		15.0	// dB, either way, so a band stays inside its coefficients
+
+// a stage's history is kept where the vector kernels load it from: left in lane 0 and
+// right in lane 2 for SSE, which multiplies the even lanes into 64 bits, and in lanes
+// 0 and 1 otherwise. the coefficients are kept four times over for the same reason
+
+#if defined(DSP_SSE41)
+#define DSP_R				2
+#else
+#define DSP_R				1
+#endif
+
+struct dsp_stage
+{
+	s32 coef[5][4];			// b0 b1 b2 a1 a2, each in every lane
+	s32 x1[4], x2[4], y1[4], y2[4];
+} __attribute__((aligned(16)));
+
+struct dsp_band
+{
+	double freq, gain, q;
+};
+
+static dsp_stage bass_stage;
+static dsp_stage eq_stages[DSP_EQ_BANDS];
+static dsp_band eq_bands[DSP_EQ_BANDS];
+
+static dsp_stage * active[1 + DSP_EQ_BANDS];	// the bass shelf first, if on, then the bands
+static int active_count;
+static int bass_on;
+
+static int dsp_rate;
+static s64 dsp_position;
+static s64 volume_gain = (s64)1 << 32;			// with 32 bits of fraction
+static s64 fade_start, fade_end;
+
+static void set_coefs(dsp_stage & s, double b0, double b1, double b2, double a0, double a1, double a2)
+{
+	const double c[5] = { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+
+	for (int i = 0; i < 5; i++)
+	{
+		s32 v = (s32)lrint(c[i] * (1 << DSP_COEF_BITS));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			s.coef[i][lane] = v;
+		}
+	}
+}
+
+static void clear_history(dsp_stage & s)
+{
+	memset(s.x1, 0, sizeof(s.x1));
+	memset(s.x2, 0, sizeof(s.x2));
+	memset(s.y1, 0, sizeof(s.y1));
+	memset(s.y2, 0, sizeof(s.y2));
+}
+
+// RBJ's cookbook with a shelf slope S of 0.707, the 1/S - 1 term, as the lowshelf_init
+// this replaced had it; not the steeper S = 1
+static void make_lowshelf(dsp_stage & s, double freq, double gain)
+{
+	double A = pow(10.0, gain / 40.0);
+	double w0 = 2.0 * M_PI * freq / dsp_rate;
+	double alpha = sin(w0) / 2.0 * sqrt((A + 1 / A) * (1.0 / 0.707 - 1.0) + 2.0);
+	double k = cos(w0);
+	double r = 2.0 * sqrt(A) * alpha;
+
+	set_coefs(s, A * ((A + 1) - (A - 1) * k + r), 2 * A * ((A - 1) - (A + 1) * k), A * ((A + 1) - (A - 1) * k - r),
+	          (A + 1) + (A - 1) * k + r, -2 * ((A - 1) + (A + 1) * k), (A + 1) + (A - 1) * k - r);
+}
+
+static void make_peaking(dsp_stage & s, const dsp_band & b)
+{
+	double A = pow(10.0, b.gain / 40.0);
+	double w0 = 2.0 * M_PI * b.freq / dsp_rate;
+	double alpha = sin(w0) / (2.0 * b.q);
+	double k = cos(w0);
+
+	set_coefs(s, 1 + alpha * A, -2 * k, 1 - alpha * A, 1 + alpha / A, -2 * k, 1 - alpha / A);
+}
+
+static void update_active()
+{
+	active_count = 0;
+	if (bass_on) active[active_count++] = &bass_stage;
+
+	for (int i = 0; i < DSP_EQ_BANDS; i++)
+	{
+		if (eq_bands[i].gain != 0.0) active[active_count++] = &eq_stages[i];
+	}
+}
+
+void dsp_setup(int rate)
+{
+	if (rate == dsp_rate) return;
+	dsp_rate = rate;
+
+	make_lowshelf(bass_stage, DSP_BASS_FREQ, DSP_BASS_GAIN);
+	for (int i = 0; i < DSP_EQ_BANDS; i++)
+	{
+		if (eq_bands[i].gain != 0.0) make_peaking(eq_stages[i], eq_bands[i]);
+	}
+}
+
+void dsp_reset(void)
+{
+	dsp_position = 0;
+	clear_history(bass_stage);
+	for (int i = 0; i < DSP_EQ_BANDS; i++)
+	{
+		clear_history(eq_stages[i]);
+	}
+}
+
+void dsp_seek(long long position)
+{
+	dsp_reset();
+	dsp_position = position;
+}
+
+void dsp_volume(int permille)
+{
+	if (permille < 0) permille = 0;
+	if (permille > 8000) permille = 8000;
+	volume_gain = ((s64)permille << 32) / 1000;
+}
+
+void dsp_fade(long long start, long long end)
+{
+	if (start < 0) start = 0;
+	if (end < start) end = start;
+	fade_start = start;
+	fade_end = end;
+}
+
+void dsp_bass(int on)
+{
+	if (on == bass_on) return;
+	bass_on = on;
+	// switched in with nothing in its history, as it always was
+	clear_history(bass_stage);
+	update_active();
+}
+
+int dsp_eq(int band, double freq, double gain_db, double q)
+{
+	if (band < 0 || band >= DSP_EQ_BANDS) return -1;
+
+	if (gain_db > DSP_MAX_GAIN) gain_db = DSP_MAX_GAIN;
+	if (gain_db < -DSP_MAX_GAIN) gain_db = -DSP_MAX_GAIN;
+	if (q <= 0.0) q = 1.0;
+	if (freq < 10.0) freq = 10.0;
+
+	eq_bands[band].freq = freq;
+	eq_bands[band].gain = gain_db;
+	eq_bands[band].q = q;
+
+	if (dsp_rate)
+	{
+		if (freq > dsp_rate * 0.45) eq_bands[band].freq = dsp_rate * 0.45;
+		if (gain_db != 0.0) make_peaking(eq_stages[band], eq_bands[band]);
+	}
+	clear_history(eq_stages[band]);
+	update_active();
+	return 0;
+}
+
+// one run of frames over which the gain is a straight line: g at the first frame, with
+// 32 bits of fraction, and step added after every frame. out is s16 or s32
+
+template <typename T>
+static void dsp_run(T * out, const short * in, int frames, s64 g, s64 step)
+{
+	const int wide = sizeof(T) == 4;
+
+	for (int i = 0; i < frames; i++, in += 2, out += 2, g += step)
+	{
+		s32 gain = (s32)(g >> (32 - DSP_GAIN_BITS));
+
+#if defined(DSP_SSE41)
+		const __m128i round = _mm_set1_epi64x((s64)1 << (DSP_COEF_BITS - 1));
+		__m128i x = _mm_slli_epi32(_mm_set_epi32(0, in[1], 0, in[0]), DSP_EXTRA_BITS);
+
+		for (int k = 0; k < active_count; k++)
+		{
+			dsp_stage * s = active[k];
+			__m128i x1 = _mm_load_si128((const __m128i *)s->x1);
+			__m128i x2 = _mm_load_si128((const __m128i *)s->x2);
+			__m128i y1 = _mm_load_si128((const __m128i *)s->y1);
+			__m128i y2 = _mm_load_si128((const __m128i *)s->y2);
+
+			__m128i acc = _mm_add_epi64(round, _mm_mul_epi32(x, _mm_load_si128((const __m128i *)s->coef[0])));
+			acc = _mm_add_epi64(acc, _mm_mul_epi32(x1, _mm_load_si128((const __m128i *)s->coef[1])));
+			acc = _mm_add_epi64(acc, _mm_mul_epi32(x2, _mm_load_si128((const __m128i *)s->coef[2])));
+			acc = _mm_sub_epi64(acc, _mm_mul_epi32(y1, _mm_load_si128((const __m128i *)s->coef[3])));
+			acc = _mm_sub_epi64(acc, _mm_mul_epi32(y2, _mm_load_si128((const __m128i *)s->coef[4])));
+			// a logical shift, but only the low half of each lane is kept, which is the same
+			__m128i y = _mm_srli_epi64(acc, DSP_COEF_BITS);
+
+			_mm_store_si128((__m128i *)s->x2, x1);
+			_mm_store_si128((__m128i *)s->x1, x);
+			_mm_store_si128((__m128i *)s->y2, y1);
+			_mm_store_si128((__m128i *)s->y1, y);
+			x = y;
+		}
+
+		__m128i acc = _mm_mul_epi32(x, _mm_set1_epi32(gain));
+		if (wide)
+		{
+			acc = _mm_srli_epi64(_mm_add_epi64(acc, _mm_set1_epi64x(1 << (DSP_GAIN_BITS - 1))), DSP_GAIN_BITS);
+			acc = _mm_min_epi32(_mm_max_epi32(acc, _mm_set1_epi32(-(1 << 23))), _mm_set1_epi32((1 << 23) - 1));
+			acc = _mm_slli_epi32(_mm_shuffle_epi32(acc, _MM_SHUFFLE(3, 1, 2, 0)), 8);
+			_mm_storel_epi64((__m128i *)out, acc);
+		}
+		else
+		{
+			acc = _mm_srli_epi64(_mm_add_epi64(acc, _mm_set1_epi64x(1 << (DSP_GAIN_BITS + DSP_EXTRA_BITS - 1))),
+			                     DSP_GAIN_BITS + DSP_EXTRA_BITS);
+			acc = _mm_shuffle_epi32(acc, _MM_SHUFFLE(3, 1, 2, 0));
+			*(s32 *)out = _mm_cvtsi128_si32(_mm_packs_epi32(acc, acc));
+		}
+#elif defined(DSP_NEON)
+		int16x4_t pair = vreinterpret_s16_s32(vld1_dup_s32((const int32_t *)in));
+		int32x2_t x = vget_low_s32(vshll_n_s16(pair, DSP_EXTRA_BITS));
+
+		for (int k = 0; k < active_count; k++)
+		{
+			dsp_stage * s = active[k];
+			int32x2_t x1 = vld1_s32(s->x1);
+			int32x2_t y1 = vld1_s32(s->y1);
+
+			int64x2_t acc = vmull_s32(x, vld1_s32(s->coef[0]));
+			acc = vmlal_s32(acc, x1, vld1_s32(s->coef[1]));
+			acc = vmlal_s32(acc, vld1_s32(s->x2), vld1_s32(s->coef[2]));
+			acc = vmlsl_s32(acc, y1, vld1_s32(s->coef[3]));
+			acc = vmlsl_s32(acc, vld1_s32(s->y2), vld1_s32(s->coef[4]));
+			int32x2_t y = vrshrn_n_s64(acc, DSP_COEF_BITS);
+
+			vst1_s32(s->x2, x1);
+			vst1_s32(s->x1, x);
+			vst1_s32(s->y2, y1);
+			vst1_s32(s->y1, y);
+			x = y;
+		}
+
+		int64x2_t acc = vmull_s32(x, vdup_n_s32(gain));
+		if (wide)
+		{
+			vst1_s32((int32_t *)out, vqshl_n_s32(vqrshrn_n_s64(acc, DSP_GAIN_BITS), 8));
+		}
+		else
+		{
+			int32x2_t v = vqrshrn_n_s64(acc, DSP_GAIN_BITS + DSP_EXTRA_BITS);
+			vst1_lane_s32((int32_t *)out, vreinterpret_s32_s16(vqmovn_s32(vcombine_s32(v, v))), 0);
+		}
+#else
+		for (int c = 0; c < 2; c++)
+		{
+			const int l = c ? DSP_R : 0;
+			s32 x = (s32)in[c] << DSP_EXTRA_BITS;
+			s64 v;
+
+			for (int k = 0; k < active_count; k++)
+			{
+				dsp_stage * s = active[k];
+				s64 acc = (s64)1 << (DSP_COEF_BITS - 1);
+				acc += (s64)s->coef[0][0] * x + (s64)s->coef[1][0] * s->x1[l] + (s64)s->coef[2][0] * s->x2[l];
+				acc -= (s64)s->coef[3][0] * s->y1[l] + (s64)s->coef[4][0] * s->y2[l];
+				s32 y = (s32)(acc >> DSP_COEF_BITS);
+
+				s->x2[l] = s->x1[l];
+				s->x1[l] = x;
+				s->y2[l] = s->y1[l];
+				s->y1[l] = y;
+				x = y;
+			}
+
+			if (wide)
+			{
+				v = ((s64)x * gain + (1 << (DSP_GAIN_BITS - 1))) >> DSP_GAIN_BITS;
+				if (v > (1 << 23) - 1) v = (1 << 23) - 1;
+				if (v < -(1 << 23)) v = -(1 << 23);
+				out[c] = (T)(v * 256);
+			}
+			else
+			{
+				v = ((s64)x * gain + (1 << (DSP_GAIN_BITS + DSP_EXTRA_BITS - 1))) >> (DSP_GAIN_BITS + DSP_EXTRA_BITS);
+				if (v > 32767) v = 32767;
+				if (v < -32768) v = -32768;
+				out[c] = (T)v;
+			}
+		}
+#endif
+	}
+}
+
+// the block is cut where the envelope bends, before the fade, through it and after it
+void dsp_process(void * out, const short * in, int frames, int wide)
+{
+	while (frames > 0)
+	{
+		s64 p = dsp_position;
+		s64 g = volume_gain, step = 0;
+		int n = frames;
+
+		if (fade_end && p >= fade_end)
+		{
+			g = 0;
+		}
+		else if (fade_end && p >= fade_start)
+		{
+			step = -(volume_gain / (fade_end - fade_start));
+			g = volume_gain + step * (p - fade_start);
+			if (fade_end - p < n) n = (int)(fade_end - p);
+		}
+		else if (fade_end && fade_start - p < n)
+		{
+			n = (int)(fade_start - p);
+		}
+
+		if (wide) dsp_run((s32 *)out, in, n, g, step);
+		else dsp_run((s16 *)out, in, n, g, step);
+
+		out = (char *)out + n * 2 * (wide ? sizeof(s32) : sizeof(s16));
+		in += n * 2;
+		frames -= n;
+		dsp_position += n;
+	}
+}
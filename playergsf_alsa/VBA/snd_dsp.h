@@ -0,0 +1,35 @@
+#ifndef __SND_DSP_H__
+#define __SND_DSP_H__
+
+// everything between the mix and the device, in one pass over each block: a gain
+// envelope that holds the volume tag, the fade and the silence after it, exact to the
+// sample; the bass shelf and up to DSP_EQ_BANDS peaking bands, as a cascade of biquads
+// in fixed point; and the one saturation, to 16 or 32 bits. the mix is always stereo
+
+#define DSP_EQ_BANDS		4
+
+// the filters are made for the rate the mix is played at, again whenever it changes
+void dsp_setup(int rate);
+
+// a new track: back to its first sample, with the filters emptied
+void dsp_reset(void);
+
+// on to sample position of the track, as after a seek, with the filters emptied too
+void dsp_seek(long long position);
+
+// in thousandths, as the volume tag is read
+void dsp_volume(int permille);
+
+// the gain falls to nothing from sample start to sample end of the track, and stays
+// there; an end of 0 is no fade
+void dsp_fade(long long start, long long end);
+
+void dsp_bass(int on);
+
+// a peaking band at freq Hz; a gain of 0 dB takes it out. -1 if band is out of range
+int dsp_eq(int band, double freq, double gain_db, double q);
+
+// frames of interleaved stereo from the mix into out, as S16 or, if wide, as S32
+void dsp_process(void * out, const short * in, int frames, int wide);
+
+#endif
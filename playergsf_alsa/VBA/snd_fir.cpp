@@ -0,0 +1,310 @@
+#include "snd_fir.h"
+
+#ifndef NO_INTERPOLATION
+
+// this was once borrowed from libmodplug, and was also used to generate the FIR coefficient
+// tables that ZSNES uses for its "FIR" interpolation mode
+
+/* 
+  ------------------------------------------------------------------------------------------------
+   fir interpolation doc,
+	(derived from "an engineer's guide to fir digital filters", n.j. loy)
+
+	calculate coefficients for ideal lowpass filter (with cutoff = fc in 0..1 (mapped to 0..nyquist))
+	  c[-N..N] = (i==0) ? fc : sin(fc*pi*i)/(pi*i)
+
+	then apply selected window to coefficients
+	  c[-N..N] *= w(0..N)
+	with n in 2*N and w(n) being a window function (see loy)
+
+	then calculate gain and scale filter coefs to have unity gain.
+  ------------------------------------------------------------------------------------------------
+*/
+
+// everything down to the tables below is constexpr, so that the compiler can evaluate it;
+// that rules out the library's sin, cos and sqrt, hence the small versions here. they are
+// good to an ulp or so over the ranges used, which is far below the quantizer
+
+#ifndef M_zPI
+#define M_zPI			3.1415926535897932384626433832795
+#endif
+#define M_zEPS			1e-8
+#define M_zBESSELEPS	1e-21
+
+namespace {
+
+constexpr double cx_fabs(double x)
+{
+	return (x < 0) ? -x : x;
+}
+
+constexpr double cx_floor(double x)
+{
+	double i = (double)(long long)x;
+	return (i > x) ? i - 1.0 : i;
+}
+
+// taylor series, after bringing x into [-pi/4, pi/4] and picking the quadrant
+constexpr double cx_sincos(double x, bool want_cos)
+{
+	const double halfpi_hi = 1.5707963267948966;
+	const double halfpi_lo = 6.123233995736766e-17;
+	double k = cx_floor(x / (M_zPI / 2) + 0.5);
+	int q = (int)((long long)k & 3);
+	x = (x - k * halfpi_hi) - k * halfpi_lo;
+	if (want_cos) q = (q + 1) & 3;
+
+	double x2 = x * x, s = 0, c = 0, term = 0;
+	if (q & 1)
+	{
+		// cos, 1 - x^2/2! + ...
+		term = 1;
+		c = 1;
+		for (int n = 1; n < 18; n += 2)
+		{
+			term *= -x2 / (double)(n * (n + 1));
+			c += term;
+		}
+		return (q == 1) ? c : -c;
+	}
+	term = x;
+	s = x;
+	for (int n = 2; n < 18; n += 2)
+	{
+		term *= -x2 / (double)(n * (n + 1));
+		s += term;
+	}
+	return (q == 0) ? s : -s;
+}
+
+constexpr double cx_sin(double x)
+{
+	return cx_sincos(x, false);
+}
+
+constexpr double cx_cos(double x)
+{
+	return cx_sincos(x, true);
+}
+
+constexpr double cx_sqrt(double x)
+{
+	if (x <= 0) return 0;
+	double r = (x > 1) ? x : 1, last = 0;
+	while (r != last)
+	{
+		last = r;
+		r = 0.5 * (r + x / r);
+		if (r >= last) break;
+	}
+	return r;
+}
+
+// the window part of fir_coef, from cos(x), sin(x) and x, where x runs over 0..2pi
+
+constexpr double fir_window(int _PType, double _LC1, double _LS1, double _LX)
+{
+	// the windows are sums of cos(n*x), which come from cos(x) by the usual recurrences
+	double	_LC2	= 2.0*_LC1*_LC1 - 1.0;
+	double	_LC3	= 2.0*_LC1*_LC2 - _LC1;
+	switch( _PType )
+	{	case WFIR_HANN:
+		return 0.50 - 0.50 * _LC1;
+					case WFIR_HAMMING:
+						return 0.54 - 0.46 * _LC1;
+					case WFIR_BLACKMANEXACT:
+						return 0.42 - 0.50 * _LC1 + 0.08 * _LC2;
+					case WFIR_BLACKMAN3T61:
+						return 0.44959 - 0.49364 * _LC1 + 0.05677 * _LC2;
+					case WFIR_BLACKMAN3T67:
+						return 0.42323 - 0.49755 * _LC1 + 0.07922 * _LC2;
+					case WFIR_BLACKMAN4T92:
+						return 0.35875 - 0.48829 * _LC1 + 0.14128 * _LC2 - 0.01168 * _LC3;
+					case WFIR_BLACKMAN4T74:
+						return 0.40217 - 0.49703 * _LC1 + 0.09392 * _LC2 - 0.00183 * _LC3;
+					case WFIR_KAISER4T:
+						return 0.40243 - 0.49804 * _LC1 + 0.09831 * _LC2 - 0.00122 * _LC3;
+					case WFIR_LANCZOS:
+						// 0 in the limit at x = 0, where the plain formula is 0/0
+						return (cx_fabs(_LX)<M_zEPS) ? 0.0 : 1 - (_LS1 / _LX);
+					default:
+						return 1.0;
+	}
+}
+
+// fir_coef( _PCnr, _POfs, ... ) only depends on _PCnr - _POfs, and over all the phases
+// that walks a grid of 1/WFIR_PHASES steps, so the whole table is made from one pass over
+// the grid. the sines and cosines along it come from rotating by one step at a time,
+// restarted from the exact values every WFIR_PHASES steps so the error can't build up
+
+template <int width>
+constexpr void init_fir_phases(s16 (*table)[width], float cutoff, int type)
+{
+	double	_LWidthM1		= width-1;
+	double	_LWidthM1Half	= 0.5*_LWidthM1;
+	double	_LPIdl			= 2.0*M_zPI/_LWidthM1;
+	double	_LCut			= cutoff;
+	double	_LGrid[width * WFIR_PHASES] = {};
+	double	_LWc = 0, _LWs = 0, _LSc = 0, _LSs = 0;
+	double	_LStepW			= _LPIdl / (double)WFIR_PHASES;
+	double	_LStepS			= _LCut * M_zPI / (double)WFIR_PHASES;
+	double	_LStepWc = cx_cos(_LStepW), _LStepWs = cx_sin(_LStepW);
+	double	_LStepSc = cx_cos(_LStepS), _LStepSs = cx_sin(_LStepS);
+
+	// grid point j is at _PCnr - _POfs = (j - (WFIR_PHASES/2 - 1)) / WFIR_PHASES
+	for (int j = 0; j < width * WFIR_PHASES; j++)
+	{
+		int		m		= j - (WFIR_PHASES/2 - 1);
+		double	_LPosU	= (double)m / (double)WFIR_PHASES;
+		double	_LPos	= _LPosU - _LWidthM1Half;
+
+		if (j % WFIR_PHASES == 0)
+		{
+			_LWc = cx_cos(_LPIdl*_LPosU);
+			_LWs = cx_sin(_LPIdl*_LPosU);
+			_LSc = cx_cos(_LCut*M_zPI*_LPos);
+			_LSs = cx_sin(_LCut*M_zPI*_LPos);
+		}
+		else
+		{
+			double c = _LWc*_LStepWc - _LWs*_LStepWs;
+			_LWs = _LWs*_LStepWc + _LWc*_LStepWs;
+			_LWc = c;
+			c = _LSc*_LStepSc - _LSs*_LStepSs;
+			_LSs = _LSs*_LStepSc + _LSc*_LStepSs;
+			_LSc = c;
+		}
+
+		if (2 * m == (width - 1) * WFIR_PHASES)
+			_LGrid[j] = (float)_LCut;
+		else
+			_LGrid[j] = (float)(fir_window(type, _LWc, _LWs, _LPIdl*_LPosU) * _LSs / (_LPos*M_zPI));
+	}
+
+	float _LScale	= (float)WFIR_QUANTSCALE;
+	float _LGain = 0;
+	for (int _LPh = 0; _LPh < WFIR_PHASES; _LPh++)
+	{
+		// phase 0 lands exactly on tap width/2-1, the last phase just short of width/2
+		const double * _LCoefs	= _LGrid + (WFIR_PHASES - 1 - _LPh);
+		s16 * _LRow		= table[_LPh];
+		int _LCc = 0;
+		for( _LCc=0,_LGain=0.0f;_LCc<width;_LCc++ )
+		{	_LGain	+= (float)_LCoefs[_LCc * WFIR_PHASES];
+		}
+		_LGain = 1.0f/_LGain;
+		for( _LCc=0;_LCc<width;_LCc++ )
+		{	float _LCoef = (float)cx_floor( 0.5 + _LScale*(float)_LCoefs[_LCc * WFIR_PHASES]*_LGain );
+			_LRow[_LCc] = (s16)( (_LCoef<-_LScale)?-_LScale:((_LCoef>_LScale)?_LScale:_LCoef) );
+		}
+	}
+}
+
+// zeroth order modified bessel function of the first kind, for the Kaiser window
+
+constexpr double kaiser_i0(double x)
+{
+	double sum = 1.0, u = 1.0, halfx = x / 2.0, temp = 0;
+	int n = 1;
+
+	do
+	{
+		temp = halfx / (double)n++;
+		u *= temp * temp;
+		sum += u;
+	}
+	while (u >= M_zBESSELEPS * sum);
+
+	return sum;
+}
+
+// row ph is for a read point ph/WPOLY_PHASES of the way past tap WPOLY_TAPS/2-1; every
+// row is scaled to unity gain, so a constant input comes back out exactly
+
+constexpr void init_poly_phases(s16 (*table)[WPOLY_TAPS], double cutoff)
+{
+	const double half = WPOLY_TAPS / 2;
+	double ibeta = 1.0 / kaiser_i0(WPOLY_BETA);
+	double coefs[WPOLY_TAPS] = {}, gain = 0;
+
+	for (int ph = 0; ph <= WPOLY_PHASES; ph++)
+	{
+		gain = 0.0;
+		for (int i = 0; i < WPOLY_TAPS; i++)
+		{
+			double t = (double)(i - (WPOLY_TAPS / 2 - 1)) - (double)ph / (double)WPOLY_PHASES;
+			double x = t / half;
+			double c = (cx_fabs(t) < M_zEPS) ? cutoff : cx_sin(M_zPI * cutoff * t) / (M_zPI * t);
+
+			c *= (x * x < 1.0) ? kaiser_i0(WPOLY_BETA * cx_sqrt(1.0 - x * x)) * ibeta : ibeta;
+			gain += (coefs[i] = c);
+		}
+		for (int i = 0; i < WPOLY_TAPS; i++)
+		{
+			double coef = cx_floor(0.5 + (double)(1L << WPOLY_QUANTBITS) * coefs[i] / gain);
+			table[ph][i] = (s16)((coef < -32768.0) ? -32768.0 : ((coef > 32767.0) ? 32767.0 : coef));
+		}
+	}
+}
+
+struct fir_tables_of : fir_tables
+{
+	constexpr fir_tables_of(int type, float cutoff) : fir_tables()
+	{
+		init_fir_phases(taps8, cutoff, type);
+		init_fir_phases(taps16, cutoff, type);
+		init_fir_phases(taps32, cutoff, type);
+	}
+};
+
+struct poly_table_of : poly_table
+{
+	constexpr poly_table_of(double cutoff) : poly_table()
+	{
+		init_poly_phases(rows, cutoff);
+	}
+};
+
+// one constant per table, which keeps each evaluation well inside the compilers' limits
+
+constexpr fir_tables_of fir_hann(WFIR_HANN, WFIR_CUTOFF);
+constexpr fir_tables_of fir_hamming(WFIR_HAMMING, WFIR_CUTOFF);
+constexpr fir_tables_of fir_blackmanexact(WFIR_BLACKMANEXACT, WFIR_CUTOFF);
+constexpr fir_tables_of fir_blackman3t61(WFIR_BLACKMAN3T61, WFIR_CUTOFF);
+constexpr fir_tables_of fir_blackman3t67(WFIR_BLACKMAN3T67, WFIR_CUTOFF);
+constexpr fir_tables_of fir_blackman4t92(WFIR_BLACKMAN4T92, WFIR_CUTOFF);
+constexpr fir_tables_of fir_blackman4t74(WFIR_BLACKMAN4T74, WFIR_CUTOFF);
+constexpr fir_tables_of fir_kaiser4t(WFIR_KAISER4T, WFIR_CUTOFF);
+constexpr fir_tables_of fir_lanczos(WFIR_LANCZOS, WFIR_CUTOFF);
+
+}
+
+const fir_tables * const fir_window_tables[WFIR_TYPES] =
+{
+	&fir_hann,
+	&fir_hamming,
+	&fir_blackmanexact,
+	&fir_blackman3t61,
+	&fir_blackman3t67,
+	&fir_blackman4t92,
+	&fir_blackman4t74,
+	&fir_kaiser4t,
+	&fir_lanczos,
+};
+
+constexpr poly_table_of fir_poly_table_full(WPOLY_ROLLOFF);
+const poly_table fir_poly_table = fir_poly_table_full;
+
+void fir_build_tables(fir_tables & tables, int type, float cutoff)
+{
+	init_fir_phases(tables.taps8, cutoff, type);
+	init_fir_phases(tables.taps16, cutoff, type);
+	init_fir_phases(tables.taps32, cutoff, type);
+}
+
+void fir_build_poly(poly_table & table, double cutoff)
+{
+	init_poly_phases(table.rows, cutoff);
+}
+
+#endif
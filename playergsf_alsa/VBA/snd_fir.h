@@ -0,0 +1,75 @@
+#ifndef __SND_FIR_H__
+#define __SND_FIR_H__
+
+// the FIR coefficient tables behind the windowed sinc and polyphase interpolators. the
+// full rate tables for every window type are generated by the compiler in snd_fir.cpp,
+// so nothing is computed at startup; only the banks for down-conversion, whose cutoff
+// depends on the ratio, are built at runtime, from the same code
+
+#include "System.h"
+
+// quantizer scale of window coefs
+#define WFIR_QUANTBITS		14
+#define WFIR_QUANTSCALE		(1L<<WFIR_QUANTBITS)
+// cutoff (1.0 == pi/2)
+#define WFIR_CUTOFF			0.95f
+// wfir type
+#define WFIR_HANN			0
+#define WFIR_HAMMING		1
+#define WFIR_BLACKMANEXACT	2
+#define WFIR_BLACKMAN3T61	3
+#define WFIR_BLACKMAN3T67	4
+#define WFIR_BLACKMAN4T92	5
+#define WFIR_BLACKMAN4T74	6
+#define WFIR_KAISER4T		7
+#define WFIR_LANCZOS		8
+#define WFIR_TYPES			9
+#define WFIR_TYPE			WFIR_KAISER4T
+
+// polyphase tables: one row of taps per sub-sample phase, every row a multiple of
+// 8 taps and 16 byte aligned so the vector kernels can use aligned coefficient loads
+
+#define WFIR_PHASEBITS		9
+#define WFIR_PHASES			(1L<<WFIR_PHASEBITS)
+#define WFIR_PHASESHIFT		(15-WFIR_PHASEBITS)
+
+#if defined(_MSC_VER)
+#define WFIR_ALIGN			__declspec(align(16))
+#else
+#define WFIR_ALIGN			__attribute__((aligned(16)))
+#endif
+
+// the fixed point polyphase mode follows libresample's filter instead: a sinc with its
+// cutoff at 0.9 of nyquist under a Kaiser window with beta 6, 8 input samples either
+// side, in Q15. it has fewer rows, but interpolates between the two either side of
+// the phase, which is where most of libresample's accuracy comes from
+
+#define WPOLY_TAPS			16
+#define WPOLY_PHASEBITS		8
+#define WPOLY_PHASES		(1L<<WPOLY_PHASEBITS)
+#define WPOLY_FRACBITS		(15-WPOLY_PHASEBITS)
+#define WPOLY_QUANTBITS		15
+#define WPOLY_ROLLOFF		0.90
+#define WPOLY_BETA			6.0
+
+struct fir_tables
+{
+	WFIR_ALIGN s16 taps8[WFIR_PHASES][8];
+	WFIR_ALIGN s16 taps16[WFIR_PHASES][16];
+	WFIR_ALIGN s16 taps32[WFIR_PHASES][32];
+};
+
+struct poly_table
+{
+	WFIR_ALIGN s16 rows[WPOLY_PHASES + 1][WPOLY_TAPS];	// the last row is a whole sample on
+};
+
+// at the full cutoff, indexed by window type
+extern const fir_tables * const fir_window_tables[WFIR_TYPES];
+extern const poly_table fir_poly_table;
+
+// the same, for any cutoff
+void fir_build_tables(fir_tables & tables, int type, float cutoff);
+void fir_build_poly(poly_table & table, double cutoff);
+
+#endif
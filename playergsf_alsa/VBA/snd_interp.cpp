@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 
 #include "libresample.h"
 
@@ -7,500 +8,668 @@
 #include "Sound.h"
 #include "snd_interp.h"
 
-// this was once borrowed from libmodplug, and was also used to generate the FIR coefficient
-// tables that ZSNES uses for its "FIR" interpolation mode
+#ifndef NO_INTERPOLATION
 
-/* 
-  ------------------------------------------------------------------------------------------------
-   fir interpolation doc,
-	(derived from "an engineer's guide to fir digital filters", n.j. loy)
+#include "snd_fir.h"
 
-	calculate coefficients for ideal lowpass filter (with cutoff = fc in 0..1 (mapped to 0..nyquist))
-	  c[-N..N] = (i==0) ? fc : sin(fc*pi*i)/(pi*i)
+#if !defined(NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define WFIR_SSE2
+#elif !defined(NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define WFIR_NEON
+#endif
 
-	then apply selected window to coefficients
-	  c[-N..N] *= w(0..N)
-	with n in 2*N and w(n) being a window function (see loy)
+// a bank holds the tables for every width at one cutoff. upsampling, which is nearly all
+// GSF playback, shares the first, which just points at the tables the compiler made for
+// the selected window; when the DirectSound clock is faster than the output the cutoff
+// has to come down with the ratio. the ratio is rounded up to a ladder of quarter octave
+// steps, whose banks are all built at once for the filter in use when it is set up or
+// switched, so a timer write only ever looks one up
 
-	then calculate gain and scale filter coefs to have unity gain.
-  ------------------------------------------------------------------------------------------------
-*/
-// quantizer scale of window coefs
+#define WFIR_BANKS			9		// the shared bank and the ladder
 
-#ifndef NO_INTERPOLATION
+// the ratio of each bank of the ladder in 1/256ths, 2^(i/4); a ratio past the last, over
+// four times the output rate, uses it all the same and aliases some
+static const u16 fir_ladder[WFIR_BANKS] = { 0, 304, 362, 431, 512, 609, 724, 861, 1024 };
 
-#define WFIR_QUANTBITS		14
-#define WFIR_QUANTSCALE		(1L<<WFIR_QUANTBITS)
-#define WFIR_8SHIFT			(WFIR_QUANTBITS-8)
-#define WFIR_16BITSHIFT		(WFIR_QUANTBITS)
-// log2(number)-1 of precalculated taps range is [4..12]
-#define WFIR_FRACBITS		12
-#define WFIR_LUTLEN			((1L<<(WFIR_FRACBITS+1))+1)
-// number of samples in window
-#define WFIR_LOG2WIDTH		3
-#define WFIR_WIDTH			(1L<<WFIR_LOG2WIDTH)
-#define WFIR_SMPSPERWING	((WFIR_WIDTH-1)>>1)
-// cutoff (1.0 == pi/2)
-#define WFIR_CUTOFF			0.95f
-// wfir type
-#define WFIR_HANN			0
-#define WFIR_HAMMING		1
-#define WFIR_BLACKMANEXACT	2
-#define WFIR_BLACKMAN3T61	3
-#define WFIR_BLACKMAN3T67	4
-#define WFIR_BLACKMAN4T92	5
-#define WFIR_BLACKMAN4T74	6
-#define WFIR_KAISER4T		7
-#define WFIR_LANCZOS		8
-#define WFIR_TYPE			WFIR_LANCZOS
-// wfir help
-#ifndef M_zPI
-#define M_zPI			3.1415926535897932384626433832795
-#endif
-#define M_zEPS			1e-8
-#define M_zBESSELEPS	1e-21
+struct fir_bank
+{
+	const fir_tables * fir;		// NULL in a ladder bank until built
+	const poly_table * poly;
+	fir_tables own_fir;
+	poly_table own_poly;
+};
+
+enum { BANK_NONE, BANK_FIR, BANK_POLY };
+
+template <int taps> struct fir_rows;
+template <> struct fir_rows<8>  { static const s16 (*get(const fir_bank * b))[8]  { return b->fir->taps8; } };
+template <> struct fir_rows<16> { static const s16 (*get(const fir_bank * b))[16] { return b->fir->taps16; } };
+template <> struct fir_rows<32> { static const s16 (*get(const fir_bank * b))[32] { return b->fir->taps32; } };
+
+static fir_bank fir_banks[WFIR_BANKS];
+static int fir_window = WFIR_TYPE;
 
-float fir_coef( int _PCnr, float _POfs, float _PCut, int _PWidth, int _PType ) //float _PPos, float _PFc, int _PLen )
+// the shared bank is only pointed at the right window, and the ladder, made for the
+// old one, is dropped to be rebuilt by build_fir_banks
+
+void init_fir_table()
 {
-	double	_LWidthM1		= _PWidth-1;
-	double	_LWidthM1Half	= 0.5*_LWidthM1;
-	double	_LPosU			= ((double)_PCnr - _POfs);
-	double	_LPos			= _LPosU-_LWidthM1Half;
-	double	_LPIdl			= 2.0*M_zPI/_LWidthM1;
-	double	_LWc,_LSi;
-	if( fabs(_LPos)<M_zEPS )
-	{	_LWc	= 1.0;
-	_LSi	= _PCut;
+	fir_banks[0].fir = fir_window_tables[fir_window];
+	fir_banks[0].poly = &fir_poly_table;
+
+	for (int i = 1; i < WFIR_BANKS; i++)
+	{
+		fir_banks[i].fir = 0;
+		fir_banks[i].poly = 0;
 	}
-	else
-	{	switch( _PType )
-	{	case WFIR_HANN:
-	_LWc = 0.50 - 0.50 * cos(_LPIdl*_LPosU);
-	break;
-					case WFIR_HAMMING:
-						_LWc = 0.54 - 0.46 * cos(_LPIdl*_LPosU);
-						break;
-					case WFIR_BLACKMANEXACT:
-						_LWc = 0.42 - 0.50 * cos(_LPIdl*_LPosU) + 0.08 * cos(2.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_BLACKMAN3T61:
-						_LWc = 0.44959 - 0.49364 * cos(_LPIdl*_LPosU) + 0.05677 * cos(2.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_BLACKMAN3T67:
-						_LWc = 0.42323 - 0.49755 * cos(_LPIdl*_LPosU) + 0.07922 * cos(2.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_BLACKMAN4T92:
-						_LWc = 0.35875 - 0.48829 * cos(_LPIdl*_LPosU) + 0.14128 * cos(2.0*_LPIdl*_LPosU) - 0.01168 * cos(3.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_BLACKMAN4T74:
-						_LWc = 0.40217 - 0.49703 * cos(_LPIdl*_LPosU) + 0.09392 * cos(2.0*_LPIdl*_LPosU) - 0.00183 * cos(3.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_KAISER4T:
-						_LWc = 0.40243 - 0.49804 * cos(_LPIdl*_LPosU) + 0.09831 * cos(2.0*_LPIdl*_LPosU) - 0.00122 * cos(3.0*_LPIdl*_LPosU);
-						break;
-					case WFIR_LANCZOS:
-						_LWc = 1 - (sin(_LPIdl*_LPosU) / (_LPIdl*_LPosU));
-						break;
-					default:
-						_LWc = 1.0;
-						break;
-	}
-	_LPos	 *= M_zPI;
-	_LSi	 = sin(_PCut*_LPos)/_LPos;
-	}
-	return (float)(_LWc*_LSi);
 }
 
-signed short fir_lut[WFIR_LUTLEN*WFIR_WIDTH];
+static bool fir_bank_has(const fir_bank & bank, int kind)
+{
+	return kind == BANK_POLY ? bank.poly != 0 : bank.fir != 0;
+}
 
-void init_fir_table()
-{	int _LPcl;
-	float _LPcllen	= (float)(1L<<WFIR_FRACBITS);	// number of precalculated lines for 0..1 (-1..0)
-	float _LNorm	= 1.0f / (float)(2.0f * _LPcllen);
-	float _LCut		= WFIR_CUTOFF;
-	float _LScale	= (float)WFIR_QUANTSCALE;
-	float _LGain,_LCoefs[WFIR_WIDTH];
-	for( _LPcl=0;_LPcl<WFIR_LUTLEN;_LPcl++ )
-	{
-		float _LOfs		= ((float)_LPcl-_LPcllen)*_LNorm;
-		int _LCc,_LIdx	= _LPcl<<WFIR_LOG2WIDTH;
-		for( _LCc=0,_LGain=0.0f;_LCc<WFIR_WIDTH;_LCc++ )
-		{	_LGain	+= (_LCoefs[_LCc] = fir_coef( _LCc, _LOfs, _LCut, WFIR_WIDTH, WFIR_TYPE ));
-		}
-		_LGain = 1.0f/_LGain;
-		for( _LCc=0;_LCc<WFIR_WIDTH;_LCc++ )
-		{	float _LCoef = (float)floor( 0.5 + _LScale*_LCoefs[_LCc]*_LGain );
-			fir_lut[_LIdx+_LCc] = (signed short)( (_LCoef<-_LScale)?-_LScale:((_LCoef>_LScale)?_LScale:_LCoef) );
+// clock is the output period and period the input period, both in cycles. the shared
+// bank, which has everything, stands in for one that isn't built
+
+static const fir_bank * get_fir_bank(u32 clock, u32 period, int kind)
+{
+	int i = 0;
+
+	if (clock > period)
+	{
+		for (i = 1; i < WFIR_BANKS - 1 && (u64)clock * 256 > (u64)period * fir_ladder[i]; i++)
+		{
 		}
+		if (!fir_bank_has(fir_banks[i], kind)) i = 0;
 	}
+	return &fir_banks[i];
 }
 
-template <class T, unsigned buffer_size>
-class sample_buffer
+// the ladder for the filter of mode, if it takes one
+static void build_fir_banks(int mode)
 {
-	unsigned ptr, filled;
-	T * buffer;
+	int kind;
 
-public:
-	sample_buffer() : ptr(0), filled(0), buffer(0) {}
-	~sample_buffer()
+	switch (mode)
 	{
-		if (buffer) delete [] buffer;
+	case 3: case 5: case 6:
+		kind = BANK_FIR;
+		break;
+	case 7:
+		kind = BANK_POLY;
+		break;
+	default:
+		return;
 	}
 
-	void clear()
+	for (int i = 1; i < WFIR_BANKS; i++)
 	{
-		if (buffer)
+		fir_bank & bank = fir_banks[i];
+		if (fir_bank_has(bank, kind)) continue;
+		if (kind == BANK_POLY)
+		{
+			fir_build_poly(bank.own_poly, WPOLY_ROLLOFF * 256.0 / (double)fir_ladder[i]);
+			bank.poly = &bank.own_poly;
+		}
+		else
 		{
-			delete [] buffer;
-			buffer = 0;
+			fir_build_tables(bank.own_fir, fir_window, WFIR_CUTOFF * 256.0f / (float)fir_ladder[i]);
+			bank.fir = &bank.own_fir;
 		}
-		ptr = filled = 0;
 	}
+}
 
-	inline unsigned size() const
-	{
-		return filled;
-	}
+// taps is a multiple of 8; smp may be unaligned, coef must be 16 byte aligned.
+// worst case |sum| is 32768 * 1.6 * 16384, well inside 32 bits
 
-	void push_back(T sample)
+template <int taps>
+static inline int fir_dot(const s16 * smp, const s16 * coef)
+{
+#if defined(WFIR_SSE2)
+	__m128i acc = _mm_setzero_si128();
+	for (int i = 0; i < taps; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(smp + i));
+		__m128i c = _mm_load_si128((const __m128i *)(coef + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(s, c));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#elif defined(WFIR_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	for (int i = 0; i < taps; i += 8)
+	{
+		int16x8_t s = vld1q_s16(smp + i);
+		int16x8_t c = vld1q_s16(coef + i);
+		acc = vmlal_s16(acc, vget_low_s16(s), vget_low_s16(c));
+		acc = vmlal_s16(acc, vget_high_s16(s), vget_high_s16(c));
+	}
+#if defined(__aarch64__)
+	return vaddvq_s32(acc);
+#else
+	int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#endif
+#else
+	int ret = 0;
+	for (int i = 0; i < taps; i++)
 	{
-		if (!buffer) buffer = new T[buffer_size];
-		buffer[ptr] = sample;
-		if (++ptr >= buffer_size) ptr = 0;
-		if (filled < buffer_size) filled++;
+		ret += smp[i] * coef[i];
 	}
+	return ret;
+#endif
+}
 
-	void erase(unsigned count)
-	{
-		if (count > filled) filled = 0;
-		else filled -= count;
-	}
+// every channel keeps one linear history that all of the kernels below read from, so the
+// filter can change between blocks without losing state. the read point is kept INTERP_LAG
+// samples into the history, enough for the widest kernel to look back, and trails the newest
+// sample by about INTERP_LEAD, enough for it to look ahead
 
-	T operator[] (int index) const
-	{
-		index += (int)(ptr - filled);
-		if (index < 0) index += (int)buffer_size;
-		else if (index >= (int)buffer_size) index -= (int)buffer_size;
-		return buffer[index];
-	}
-};
+#define INTERP_LAG			15
+#define INTERP_LEAD			19
+#define INTERP_SIZE			4096
+#define INTERP_SLACK		8
+
+// linear history, so a whole window of taps is one contiguous load; the live samples
+// get slid back to the front once the end of the storage is reached
 
-class foo_null : public foo_interpolate
+template <unsigned taps, unsigned buffer_size>
+class sample_window
 {
-	int sample;
+	unsigned start, end;
+	s16 buffer[buffer_size];
 
 public:
-	foo_null() : sample(0) {}
-	~foo_null() {}
-
-	void reset() {}
-
-	void push(int psample)
-	{
-		sample = psample;
-	}
+	sample_window() : start(0), end(0) {}
 
-	int pop(double rate)
+	void clear()
 	{
-		return sample;
+		start = end = 0;
 	}
-};
-
-class foo_linear : public foo_interpolate
-{
-	sample_buffer<int,4> samples;
 
-	unsigned position;
-
-	inline int smp(int index)
+	inline unsigned size() const
 	{
-		return samples[index];
+		return end - start;
 	}
 
-public:
-	foo_linear()
+	inline const s16 * data() const
 	{
-		position = 0;
+		return buffer + start;
 	}
 
-	~foo_linear() {}
-
-	void reset()
+	void push_back(int sample)
 	{
-		position = 0;
-		samples.clear();
+		if (end >= buffer_size)
+		{
+			// keep at most buffer_size - taps samples, dropping the oldest
+			if (end - start > buffer_size - taps) start = end - (buffer_size - taps);
+			memmove(buffer, buffer + start, (end - start) * sizeof(s16));
+			end -= start;
+			start = 0;
+		}
+		if (sample > 32767) sample = 32767;
+		else if (sample < -32768) sample = -32768;
+		buffer[end++] = (s16)sample;
 	}
 
-	void push(int sample)
+	void erase(unsigned count)
 	{
-		samples.push_back(sample);
+		if (count > end - start) start = end;
+		else start += count;
 	}
+};
 
-	int pop(double rate)
-	{
-		int ret;
-		unsigned lrate;
+// the timer can be reprogrammed while samples from the old rate are still waiting to be
+// played, so a change of period is queued at the sample it starts from, and takes over
+// when the read point gets there. that way the spacing of every sample is the one it
+// was actually produced at, and the output never jumps in time
 
-		if (position > 0x7fff)
-		{
-			unsigned howmany = position >> 15;
-			position &= 0x7fff;
-			samples.erase(howmany);
-		}
+#define INTERP_CHANGES		8
 
-		if (samples.size() < 2) return 0;
+struct interp_change
+{
+	u32 at;				// in pushed samples since the channel was reset
+	u32 period;			// cycles per input sample from there on
+};
 
-		ret  = smp(0) * (0x8000 - position);
-		ret += smp(1) * position;
-		ret >>= 15;
+struct interp_channel
+{
+	sample_window<INTERP_LAG + INTERP_LEAD, INTERP_SIZE> samples;
+	u32 pushed;
 
-		// wahoo, takes care of drifting
-		if (samples.size() > 2)
-		{
-			rate += (.5 / 32768.);
-		}
+	// the read point is samples.data()[index], plus rem cycles of the period cycles
+	// it takes the DirectSound clock to get to the next sample
+	unsigned index;
+	u32 rem, period;
+	int ahead;			// samples left past the read point after the last block
 
-		lrate = (unsigned)(32768. * rate);
-		position += lrate;
+	int timer;
+	int changes;
+	interp_change change[INTERP_CHANGES];
 
-		return ret;
-	}
-};
+	s16 last;			// held while the input is dry, like the hardware does
+	bool starved;
 
-// and this integer cubic interpolation implementation was kind of borrowed from either TiMidity
-// or the P.E.Op.S. SPU project, or is in use in both, or something...
+	void * resampler;
+	unsigned fed;		// samples handed to libresample so far, relative to samples.data()
+	s16 held[INTERP_SLACK];	// libresample output produced ahead of the block it belongs to
+	int nheld;
 
-class foo_cubic : public foo_interpolate
-{
-	sample_buffer<int,12> samples;
+	int mode;			// the filter it was last rendered with
 
-	unsigned position;
+	interp_channel() : pushed(0), index(0), rem(0), period(1), ahead(0), timer(0), changes(0),
+		last(0), starved(false), resampler(0), fed(0), nheld(0), mode(0) {}
 
-	inline int smp(int index)
+	// where the next queued change is, relative to samples.data()
+	inline unsigned next_change() const
 	{
-		return samples[index];
+		return changes ? change[0].at - (pushed - samples.size()) : ~0U;
 	}
 
-public:
-	foo_cubic()
+	void take_change()
 	{
-		position = 0;
+		period = change[0].period;
+		changes--;
+		memmove(change, change + 1, changes * sizeof(interp_change));
 	}
+};
 
-	~foo_cubic() {}
+// the kernels are stateless: taps samples starting at smp, with the read point frac/32768
+// of the way past smp[center]. they are instantiated straight into render_block, so there
+// is no per-sample call left once a block is going
+
+struct foo_null
+{
+	enum { taps = 1, center = 0, bank = BANK_NONE };
 
-	void reset()
+	static inline int sample(const s16 * smp, unsigned frac, const fir_bank * bank)
 	{
-		position = 0;
-		samples.clear();
+		return smp[0];
 	}
+};
+
+struct foo_linear
+{
+	enum { taps = 2, center = 0, bank = BANK_NONE };
 
-	void push(int sample)
+	static inline int sample(const s16 * smp, unsigned frac, const fir_bank * bank)
 	{
-		samples.push_back(sample);
+		return (smp[0] * (0x8000 - (int)frac) + smp[1] * (int)frac) >> 15;
 	}
+};
 
-	int pop(double rate)
-	{
-		int ret;
-		unsigned lrate;
+// and this integer cubic interpolation implementation was kind of borrowed from either TiMidity
+// or the P.E.Op.S. SPU project, or is in use in both, or something...
 
-		if (position > 0x7fff)
-		{
-			unsigned howmany = position >> 15;
-			position &= 0x7fff;
-			samples.erase(howmany);
-		}
+struct foo_cubic
+{
+	enum { taps = 4, center = 0, bank = BANK_NONE };
 
-		if (samples.size() < 4) return 0;
+	static inline int sample(const s16 * smp, unsigned frac, const fir_bank * bank)
+	{
+		int ret;
 
-		ret  = smp(3) - 3 * smp(2) + 3 * smp(1) - smp(0);
-		ret *= ((signed)position - (2 << 15)) / 6;
+		ret  = smp[3] - 3 * smp[2] + 3 * smp[1] - smp[0];
+		ret *= ((signed)frac - (2 << 15)) / 6;
 		ret >>= 15;
-		ret += smp(2) - 2 * smp(1) + smp(0);
-		ret *= ((signed)position - (1 << 15)) >> 1;
+		ret += smp[2] - 2 * smp[1] + smp[0];
+		ret *= ((signed)frac - (1 << 15)) >> 1;
 		ret >>= 15;
-		ret += smp(1) - smp(0);
-		ret *= (signed)position;
+		ret += smp[1] - smp[0];
+		ret *= (signed)frac;
 		ret >>= 15;
-		ret += smp(0);
+		ret += smp[0];
 
 		if (ret > 32767) ret = 32767;
 		else if (ret < -32768) ret = -32768;
 
-		// wahoo, takes care of drifting
-		if (samples.size() > 8)
-		{
-			rate += (.5 / 32768.);
-		}
-
-		lrate = (unsigned)(32768. * rate);
-		position += lrate;
-
 		return ret;
 	}
 };
 
-class foo_fir : public foo_interpolate
+template <int taps_>
+struct foo_fir
 {
-	sample_buffer<int,24> samples;
-
-	unsigned position;
+	enum { taps = taps_, center = taps_ / 2 - 1, bank = BANK_FIR };
 
-	inline int smp(int index)
+	static inline int sample(const s16 * smp, unsigned frac, const fir_bank * bank)
 	{
-		return samples[index];
+		int ret = fir_dot<taps>(smp, fir_rows<taps>::get(bank)[frac >> WFIR_PHASESHIFT]);
+		ret >>= WFIR_QUANTBITS;
+
+		if (ret > 32767) ret = 32767;
+		else if (ret < -32768) ret = -32768;
+
+		return ret;
 	}
+};
 
-public:
-	foo_fir()
+// two rows either side of the phase, and the line between their results; that is the same
+// as interpolating the coefficients, but keeps the inner loop a plain fir_dot
+
+struct foo_polyphase
+{
+	enum { taps = WPOLY_TAPS, center = WPOLY_TAPS / 2 - 1, bank = BANK_POLY };
+
+	static inline int sample(const s16 * smp, unsigned frac, const fir_bank * bank)
 	{
-		position = 0;
+		const s16 (*rows)[WPOLY_TAPS] = bank->poly->rows + (frac >> WPOLY_FRACBITS);
+		int lo = fir_dot<WPOLY_TAPS>(smp, rows[0]);
+		int hi = fir_dot<WPOLY_TAPS>(smp, rows[1]);
+		int ret = lo + (int)((((s64)hi - lo) * (int)(frac & ((1 << WPOLY_FRACBITS) - 1))) >> WPOLY_FRACBITS);
+		ret = (ret + (1 << (WPOLY_QUANTBITS - 1))) >> WPOLY_QUANTBITS;
+
+		if (ret > 32767) ret = 32767;
+		else if (ret < -32768) ret = -32768;
+
+		return ret;
 	}
+};
 
-	~foo_fir() {}
+// drops the history that no kernel can reach any more and notes how far ahead the
+// input is. that only grows if the clock is wrong, say a timer cascade we don't
+// model, so past a point the read point just skips forward to catch up
 
-	void reset()
+static void settle_block(interp_channel & c, unsigned index)
+{
+	if ((int)c.samples.size() - (int)index > INTERP_SIZE / 8)
 	{
-		position = 0;
-		samples.clear();
+		index = c.samples.size() - INTERP_LEAD;
 	}
 
-	void push(int sample)
+	if (index > INTERP_LAG)
 	{
-		samples.push_back(sample);
+		unsigned howmany = index - INTERP_LAG;
+		c.samples.erase(howmany);
+		index -= howmany;
+		c.fed = (c.fed > howmany) ? c.fed - howmany : 0;
 	}
 
-	int pop(double rate)
+	c.index = index;
+	c.ahead = (int)c.samples.size() - (int)index;
+}
+
+static inline void hold(interp_channel & c, s16 * out, int count)
+{
+	for (int i = 0; i < count; i++)
 	{
-		int ret;
-		unsigned lrate;
+		out[i] = c.last;
+	}
+}
 
-		if (position > 0x7fff)
+// renders count output samples, clock cycles apart; the read point moves
+// in whole cycles, so it follows the emulated clocks exactly and never drifts against
+// the input. the phase comes from rem through a reciprocal of the period, so there is
+// no division per sample, only per change of period
+
+template <class filter>
+static void render_block(interp_channel & c, s16 * out, int count, u32 clock)
+{
+	const s16 * smp = c.samples.data();
+	unsigned avail = c.samples.size();
+	unsigned index = c.index;
+	unsigned next = c.next_change();
+	u32 rem = c.rem;
+	u32 period = c.period;
+	u64 recip = ((1ULL << 47) + period - 1) / period;	// rem * recip >> 32 is the 15 bit phase
+	const fir_bank * bank = (int)filter::bank != BANK_NONE ? get_fir_bank(clock, period, filter::bank) : 0;
+	int done = 0;
+
+	if (c.starved)
+	{
+		// the input stopped for a while; hold until the point in this block where what
+		// has come in since lines up with the usual lead again
+		int ready = (int)(avail - index) - INTERP_LEAD;
+
+		if (ready <= 0)
 		{
-			unsigned howmany = position >> 15;
-			position &= 0x7fff;
-			samples.erase(howmany);
+			hold(c, out, count);
+			return;
 		}
 
-		if (samples.size() < 8) return 0;
-
-		ret  = smp(0) * fir_lut[(position & ~7)    ];
-		ret += smp(1) * fir_lut[(position & ~7) + 1];
-		ret += smp(2) * fir_lut[(position & ~7) + 2];
-		ret += smp(3) * fir_lut[(position & ~7) + 3];
-		ret += smp(4) * fir_lut[(position & ~7) + 4];
-		ret += smp(5) * fir_lut[(position & ~7) + 5];
-		ret += smp(6) * fir_lut[(position & ~7) + 6];
-		ret += smp(7) * fir_lut[(position & ~7) + 7];
-		ret >>= WFIR_QUANTBITS;
-
-		if (ret > 32767) ret = 32767;
-		else if (ret < -32768) ret = -32768;
+		done = count - (int)(((u64)ready * period) / clock);
+		if (done < 0) done = 0;
+		hold(c, out, done);
+		c.starved = false;
+	}
 
-		// wahoo, takes care of drifting
-		if (samples.size() > 16)
+	for (; done < count; done++)
+	{
+		if (index + (filter::taps - filter::center) > avail)
 		{
-			rate += (.5 / 32768.);
+			hold(c, out + done, count - done);
+			c.starved = true;
+			break;
 		}
 
-		lrate = (unsigned)(32768. * rate);
-		position += lrate;
+		out[done] = c.last = filter::sample(smp + index - filter::center, (unsigned)((rem * recip) >> 32), bank);
 
-		return ret;
+		rem += clock;
+		while (rem >= period)
+		{
+			rem -= period;
+			if (++index == next)
+			{
+				c.take_change();
+				next = c.next_change();
+				period = c.period;
+				recip = ((1ULL << 47) + period - 1) / period;
+				if ((int)filter::bank != BANK_NONE) bank = get_fir_bank(clock, period, filter::bank);
+			}
+		}
 	}
-};
 
-class foo_libresample : public foo_interpolate
-{
-	sample_buffer<float,32> samples;
+	c.rem = rem;
+	settle_block(c, index);
+}
 
-	void * resampler;
+// libresample keeps its own history, so it is only fed what it hasn't seen yet; the read
+// point is then parked where the other kernels would have it, in case the filter changes.
+// channels that always get the same number of samples, like the two sides of the final
+// mix, go through one interleaved handle, which shares the filter work between them
 
-public:
-	foo_libresample()
-	{
-		resampler = 0;
+static void render_libresample(interp_channel * const * ch, s16 * const * out, int nch, int count, u32 clock)
+{
+	static float in[INTERP_SIZE * 2];
+	static float fout[INTERP_SIZE * 2];
+	interp_channel & c = *ch[0];
+	unsigned avail = c.samples.size();
+	double rate;
+	s16 held[INTERP_SLACK];
+	int nheld = c.nheld;
+	int i, j, k, used = 0, returned, want, total, pad;
+
+	if (!c.resampler)
+	{
+		c.resampler = resample_open_channels(0, .25, 44100. / 4000., nch);
+		for (k = 0; k < nch; k++)
+		{
+			ch[k]->fed = c.index;
+			ch[k]->nheld = 0;
+		}
+		nheld = 0;
 	}
 
-	~foo_libresample()
+	for (k = 0; k < nch; k++)
 	{
-		reset();
-	}
+		const s16 * smp = ch[k]->samples.data();
 
-	void reset()
-	{
-		samples.clear();
-		if (resampler)
+		for (i = 0; i < (int)(avail - c.fed); i++)
 		{
-			resample_close(resampler);
-			resampler = 0;
+			in[i * nch + k] = smp[c.fed + i];
 		}
 	}
 
-	void push(int sample)
-	{
-		samples.push_back(float(sample));
-	}
+	// it takes one ratio per call, so the queued changes just apply a block early
+	while (c.changes) c.take_change();
+	rate = double(clock) / double(c.period);
+
+	// ask for a little more than the block, since how much it can give back for a
+	// given input wobbles by a sample or so either way
+	want = count + INTERP_SLACK - c.nheld;
+	if (want > INTERP_SIZE) want = INTERP_SIZE;
+
+	returned = resample_process_interleaved(c.resampler, 1. / rate, in, i, 0, &used, fout, want);
+	if (returned < 0) returned = 0;
+
+	// it only runs short while filling up, so the shortfall goes in front as silence,
+	// along with enough extra to cover the wobble from then on
+	total = nheld + returned;
+	pad = (total < count) ? count - total + INTERP_SLACK / 2 : 0;
+
+	// never past what libresample still has to be fed, so that doesn't get dropped
+	j = (avail > INTERP_LEAD) ? avail - INTERP_LEAD : 0;
+	if ((unsigned)j > c.fed + used) j = c.fed + used;
 
-	int pop(double rate)
+	for (k = 0; k < nch; k++)
 	{
-		int ret;
+		interp_channel & d = *ch[k];
 
-		if (!resampler)
-		{
-			resampler = resample_open(0, .25, 44100. / 4000.);
-		}
+		memcpy(held, d.held, nheld * sizeof(s16));
+		d.fed += used;
+		d.nheld = total + pad - count;
 
+		for (i = 0; i < total + pad; i++)
 		{
-			int count = samples.size();
-			float in[32];
-			float out;
-			int used, returned;
+			int ret;
 
-			for (used = 0; used < count; used++)
+			if (i < pad) ret = 0;
+			else if (i - pad < nheld) ret = held[i - pad];
+			else
 			{
-				in[used] = samples[used];
+				ret = (int)fout[(i - pad - nheld) * nch + k];
+
+				if (ret > 32767) ret = 32767;
+				else if (ret < -32768) ret = -32768;
 			}
 
-			returned = resample_process(resampler, 1. / rate, in, count, 0, &used, &out, 1);
+			if (i < count) out[k][i] = ret;
+			else d.held[i - count] = ret;
+		}
 
-			if (used)
-			{
-				samples.erase(used);
-			}
+		if (count) d.last = out[k][count - 1];
+		d.starved = false;
+		d.rem = 0;
+		d.period = c.period;
+		d.changes = 0;
 
-			if (returned < 1) return 0;
+		settle_block(d, j);
+	}
+}
 
-			ret = (int)out;
-		}
+// and here is the implementation specific code, in a messier state than the stuff above
 
-		if (ret > 32767) ret = 32767;
-		else if (ret < -32768) ret = -32768;
+// 0 and 1 are DirectSound A and B; 2 and 3 are the left and right of the final mix
+// when the native pipeline is in use, see interp_resample_mix
+static interp_channel channels[4];
+static u32 timer_period[2] = { 1, 1 };
+static u64 mix_owed;
 
-		return ret;
+static void close_resampler(interp_channel & c)
+{
+	if (c.resampler)
+	{
+		resample_close(c.resampler);
+		c.resampler = 0;
 	}
-};
+}
 
-foo_interpolate * get_filter(int which)
+static void render_channel(interp_channel & c, s16 * out, int count, u32 clock)
 {
-	switch (which)
+	switch (c.mode)
 	{
 	default:
-		return new foo_null;
+		render_block<foo_null>(c, out, count, clock);
+		break;
 	case 1:
-		return new foo_linear;
+		render_block<foo_linear>(c, out, count, clock);
+		break;
 	case 2:
-		return new foo_cubic;
+		render_block<foo_cubic>(c, out, count, clock);
+		break;
 	case 3:
-		return new foo_fir;
+		render_block<foo_fir<8> >(c, out, count, clock);
+		break;
 	case 4:
-		return new foo_libresample;
+		{
+			interp_channel * ch = &c;
+			render_libresample(&ch, &out, 1, count, clock);
+		}
+		break;
+	case 5:
+		render_block<foo_fir<16> >(c, out, count, clock);
+		break;
+	case 6:
+		render_block<foo_fir<32> >(c, out, count, clock);
+		break;
+	case 7:
+		render_block<foo_polyphase>(c, out, count, clock);
+		break;
 	}
 }
 
-// and here is the implementation specific code, in a messier state than the stuff above
+static void render_channels(interp_channel * const * ch, s16 * const * out, int nch, int count, u32 clock)
+{
+	if (ch[0]->mode == 4)
+	{
+		render_libresample(ch, out, nch, count, clock);
+	}
+	else
+	{
+		for (int k = 0; k < nch; k++)
+		{
+			render_channel(*ch[k], out[k], count, clock);
+		}
+	}
+}
+
+// a new filter takes over on a block boundary. going straight from one to the other can
+// click, since they don't agree to the sample, and libresample starts out on silence, so
+// the block is made by both from the same state and faded across from the old to the new
+
+static interp_channel switch_saved[2];
+static s16 switch_old[2][INTERP_SIZE];
+
+static void render_switch(interp_channel * const * ch, s16 * const * out, int nch, int count, u32 clock, int which)
+{
+	s16 * old[2] = { switch_old[0], switch_old[1] };
+	int i, k;
+
+	for (k = 0; k < nch; k++)
+	{
+		switch_saved[k] = *ch[k];
+	}
+
+	render_channels(ch, old, nch, count, clock);
+
+	for (k = 0; k < nch; k++)
+	{
+		interp_channel & c = *ch[k];
+		void * resampler = c.resampler;
+
+		// back to where the old filter started, keeping a handle it may have opened
+		c = switch_saved[k];
+		c.resampler = resampler;
+
+		// the history is shared, so only libresample's private state has to go
+		if (which != 4) close_resampler(c);
+		c.mode = which;
+	}
+
+	render_channels(ch, out, nch, count, clock);
+
+	for (k = 0; k < nch; k++)
+	{
+		for (i = 0; i < count; i++)
+		{
+			out[k][i] = (old[k][i] * (count - i) + out[k][i] * i) / count;
+		}
+	}
+}
 
 #endif
 
@@ -511,46 +680,75 @@ extern bool timer1On;
 extern int timer1Reload;
 extern int timer1ClockReload;
 
-double calc_rate(int timer)
+// the DirectSound clock only changes when a timer is written or the output rate changes,
+// so this is where the period is worked out, once, from the reload and prescaler; with
+// the timer stopped nothing gets pushed, and the period only matters for the hold
+
+void interp_update_rate(int timer)
 {
+#ifndef NO_INTERPOLATION
+	u32 period = SOUND_CLOCK_TICKS;
+
 	if (timer ? timer1On : timer0On)
 	{
-		return double(SOUND_CLOCK_TICKS) /
-			double((0x10000 - (timer ? timer1Reload : timer0Reload)) * 
-			(timer ? timer1ClockReload : timer0ClockReload));
-	}
-	else
-	{
-		return 1.;
+		period = (u32)(0x10000 - (timer ? timer1Reload : timer0Reload)) *
+			(u32)(timer ? timer1ClockReload : timer0ClockReload);
+		if (!period) period = SOUND_CLOCK_TICKS;
 	}
-}
 
-#ifndef NO_INTERPOLATION
+	if (period == timer_period[timer]) return;
+	timer_period[timer] = period;
 
-static foo_interpolate * interp[2];
+	for (int i = 0; i < 2; i++)
+	{
+		interp_channel & c = channels[i];
+		if (c.timer != timer) continue;
 
-static int interpolation = 0;
+		// the interval the counter is in now still runs at the old reload, so the new
+		// period starts from the next sample; if the read point is already there,
+		// say the input had run dry, it applies straight away
+		u32 at = c.pushed;
+		if ((int)(at - (c.pushed - c.samples.size())) <= (int)c.index)
+		{
+			c.rem = (u32)(((u64)c.rem * period) / c.period);
+			c.period = period;
+			c.changes = 0;
+			continue;
+		}
 
+		while (c.changes > 0 && c.change[c.changes - 1].at >= at) c.changes--;
+		if (c.changes == INTERP_CHANGES) c.changes--;
+		c.change[c.changes].at = at;
+		c.change[c.changes].period = period;
+		c.changes++;
+	}
 #endif
+}
 
 void interp_setup(int which)
 {
 #ifndef NO_INTERPOLATION
-	init_fir_table();
+	// interp_window may have been first, and built the ladder for its window already
+	if (!fir_banks[0].fir) init_fir_table();
+	build_fir_banks(which);
 	for (int i = 0; i < 2; i++)
 	{
-		interp[i] = get_filter(which);
+		interp_update_rate(i);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		interp_reset(i);
+		channels[i].mode = which;
 	}
-	interpolation = which;
 #endif
 }
 
 void interp_cleanup()
 {
 #ifndef NO_INTERPOLATION
-	for (int i = 0; i < 2; i++)
+	for (int i = 0; i < 4; i++)
 	{
-		delete interp[i];
+		close_resampler(channels[i]);
 	}
 #endif
 }
@@ -558,39 +756,131 @@ void interp_cleanup()
 void interp_switch(int which)
 {
 #ifndef NO_INTERPOLATION
-	for (int i = 0; i < 2; i++)
-	{
-		delete interp[i];
-		interp[i] = get_filter(which);
-	}
+	if (which < 0 || which >= INTERP_MODES) return;
 
-	interpolation = which;
+	// picked up by each channel at its next block, see render_switch
+	soundInterpolation = which;
+	build_fir_banks(which);
 #endif
 }
 
-void interp_reset(int ch)
+void interp_window(int type)
 {
 #ifndef NO_INTERPOLATION
-	if (soundInterpolation != interpolation) interp_switch(soundInterpolation);
+	if (type < 0 || type >= WFIR_TYPES) return;
 
-	interp[ch]->reset();
+	fir_window = type;
+	init_fir_table();
+	build_fir_banks(soundInterpolation);
+#endif
+}
+
+void interp_reset(int ch)
+{
+#ifndef NO_INTERPOLATION
+	interp_channel & c = channels[ch];
+
+	close_resampler(c);
+
+	// start out with silence on both sides of the read point, so every kernel has what
+	// it needs from the first block on
+	c.samples.clear();
+	for (int i = 0; i < INTERP_LAG + INTERP_LEAD; i++)
+	{
+		c.samples.push_back(0);
+	}
+	c.pushed = c.samples.size();
+	c.index = INTERP_LAG;
+	c.rem = 0;
+	c.period = (ch < 2) ? timer_period[c.timer] : 1;
+	c.changes = 0;
+	if (ch == 2) mix_owed = 0;
+	c.ahead = INTERP_LEAD;
+	c.last = 0;
+	c.starved = false;
+	c.fed = 0;
 #endif
 }
 
 void interp_push(int ch, int sample)
 {
 #ifndef NO_INTERPOLATION
-	if (soundInterpolation != interpolation) interp_switch(soundInterpolation);
+	channels[ch].samples.push_back(sample);
+	channels[ch].pushed++;
+#endif
+}
+
+void interp_render(int ch, int timer, short * out, int count)
+{
+#ifndef NO_INTERPOLATION
+	interp_channel & c = channels[ch];
 
-	interp[ch]->push(sample);
+	if (c.timer != timer)
+	{
+		// moved to the other timer, whose rate is the one from now on
+		c.timer = timer;
+		c.period = timer_period[timer];
+		c.changes = 0;
+	}
+
+	if (c.mode != soundInterpolation)
+	{
+		interp_channel * ch = &c;
+		render_switch(&ch, &out, 1, count, SOUND_CLOCK_TICKS, soundInterpolation);
+	}
+	else
+	{
+		render_channel(c, out, count, SOUND_CLOCK_TICKS);
+	}
+#else
+	memset(out, 0, count * sizeof(short));
 #endif
 }
 
-int interp_pop(int ch, double rate)
+// the native pipeline: the whole mix is made at the tick rate, with DirectSound held
+// between timer overflows as the hardware does, and only then taken to the output rate.
+// both sides are counted in cycles times the output rate, so the step stays exact;
+// frames of interleaved stereo go in and the number that came out is returned, in place
+
+int interp_resample_mix(u16 * wave, int frames, int rate)
 {
 #ifndef NO_INTERPOLATION
-	return interp[ch]->pop(rate);
+	static s16 left[INTERP_SIZE], right[INTERP_SIZE];
+	interp_channel & l = channels[2];
+	interp_channel & r = channels[3];
+	interp_channel * ch[2] = { &l, &r };
+	s16 * out[2] = { left, right };
+	u32 period = (u32)SOUND_CLOCK_TICKS * (u32)rate;
+	const u32 clock = 16777216;
+	int count, i;
+
+	l.period = r.period = period;
+
+	for (i = 0; i < frames; i++)
+	{
+		l.samples.push_back((s16)wave[i * 2]);
+		r.samples.push_back((s16)wave[i * 2 + 1]);
+	}
+	l.pushed += frames;
+	r.pushed += frames;
+
+	// as many outputs as the input covers, carrying the remainder to the next block
+	mix_owed += (u64)frames * period;
+	count = (int)(mix_owed / clock);
+	mix_owed -= (u64)count * clock;
+	if (count > INTERP_SIZE) count = INTERP_SIZE;
+
+	if (l.mode != soundInterpolation) render_switch(ch, out, 2, count, clock, soundInterpolation);
+	else render_channels(ch, out, 2, count, clock);
+
+	for (i = 0; i < count; i++)
+	{
+		wave[i * 2] = left[i];
+		wave[i * 2 + 1] = right[i];
+	}
+
+	return count;
 #else
-	return 0;
+	return frames;
 #endif
 }
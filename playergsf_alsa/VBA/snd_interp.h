@@ -1,37 +1,38 @@
 #ifndef __SND_INTERP_H__
 #define __SND_INTERP_H__
 
-// simple interface that could easily be recycled
+// complicated, synced interface, specific to this implementation: FIFO samples are pushed
+// as the timers fire and a whole buffer's worth of output is rendered at once, with the
+// filter type looked up once per block rather than once per sample
 
-class foo_interpolate
-{
-public:
-	foo_interpolate() {}
-	virtual ~foo_interpolate() {};
-
-	virtual void reset() = 0;
-
-	virtual void push(int sample) = 0;
-	virtual int pop(double rate) = 0;
-};
-
-foo_interpolate * get_filter(int which);
-
-
-// complicated, synced interface, specific to this implementation
-
-double calc_rate(int timer);
+// to be called whenever a timer's reload, prescaler or enable bit or SOUND_CLOCK_TICKS changes
+void interp_update_rate(int timer);
 
 extern "C" {
 void interp_setup(int which);
 void interp_cleanup();
 }
 
+// 0 none, 1 linear, 2 cubic, 3 8-tap FIR, 4 libresample, 5 16-tap FIR, 6 32-tap FIR,
+// 7 fixed-point polyphase
+#define INTERP_MODES 8
+
+// takes effect from the next block of each channel, faded in over that block. the first
+// switch to a FIR or the polyphase mode builds its down-conversion banks, see below
 void interp_switch(int which);
 
+// the window of the FIR modes, one of the WFIR_ types in snd_fir.h. the full rate tables
+// are made at build time, but with a FIR mode selected this rebuilds the down-conversion
+// banks for the new window, several milliseconds of sines and cosines; it is meant for
+// a setting changed now and then, not for every block
+void interp_window(int type);
+
 void interp_reset(int ch);
 void interp_push(int ch, int sample);
-int interp_pop(int ch, double rate);
+void interp_render(int ch, int timer, short * out, int count);
+
+// the alternative, native pipeline: the finished mix goes through here once instead
+int interp_resample_mix(unsigned short * wave, int frames, int rate);
 
 #endif
 
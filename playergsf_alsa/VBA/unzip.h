@@ -208,6 +208,29 @@ extern int ZEXPORT  unzLocateFile OF((unzFile file,
 */
 
 
+/* unz_file_pos is where an entry's record sits in the central dir, so it can be
+   made the current file again without walking the dir from the start */
+typedef struct unz_file_pos_s
+{
+    uLong pos_in_zip_directory;   /* offset in the central dir */
+    uLong num_of_file;            /* number of the file */
+} unz_file_pos;
+
+extern int ZEXPORT  unzGetFilePos OF((unzFile file,
+                                     unz_file_pos *file_pos));
+/*
+  Get the position of the current file, for unzGoToFilePos.
+  return UNZ_OK if there is no problem
+*/
+
+extern int ZEXPORT  unzGoToFilePos OF((unzFile file,
+                                      const unz_file_pos *file_pos));
+/*
+  Set the current file of the zipfile to one remembered by unzGetFilePos.
+  return UNZ_OK if there is no problem
+*/
+
+
 extern int ZEXPORT  unzGetCurrentFileInfo OF((unzFile file,
                                              unz_file_info *pfile_info,
                                              char *szFileName,
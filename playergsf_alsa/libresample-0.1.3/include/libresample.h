@@ -22,6 +22,14 @@ void *resample_open(int      highQuality,
                     double   minFactor,
                     double   maxFactor);
 
+/* Like resample_open, but for frames of 1 to 8 interleaved channels
+   that are all taken through the filter in the same pass */
+
+void *resample_open_channels(int      highQuality,
+                             double   minFactor,
+                             double   maxFactor,
+                             int      channels);
+
 void *resample_dup(const void *handle);
 
 int resample_get_filter_width(const void *handle);
@@ -35,6 +43,18 @@ int resample_process(void   *handle,
                      float  *outBuffer,
                      int     outBufferLen);
 
+/* The same, with interleaved frames in and out; lengths, inBufferUsed
+   and the return value all count frames */
+
+int resample_process_interleaved(void   *handle,
+                                 double  factor,
+                                 float  *inBuffer,
+                                 int     inBufferLen,
+                                 int     lastFlag,
+                                 int    *inBufferUsed,
+                                 float  *outBuffer,
+                                 int     outBufferLen);
+
 void resample_close(void *handle);
 
 #ifdef __cplusplus
@@ -11,7 +11,7 @@
 
   This file provides Kaiser-windowed low-pass filter support,
   including a function to create the filter coefficients, and
-  two functions to apply the filter at a particular point.
+  the functions that apply the filter at a particular point.
 
 **********************************************************************/
 
@@ -25,6 +25,12 @@
 #include <stdio.h>
 #include <math.h>
 
+#if LRS_SSE
+#include <xmmintrin.h>
+#elif LRS_NEON
+#include <arm_neon.h>
+#endif
+
 /* LpFilter()
  *
  * reference: "Digital Filters, 2nd edition"
@@ -112,77 +118,73 @@ void lrsLpFilter(double c[], int N, double frq, double Beta, int Num)
    }
 }
 
-float lrsFilterUp(float Imp[],  /* impulse response */
-                  float ImpD[], /* impulse response deltas */
-                  UWORD Nwing,  /* len of one wing of filter */
-                  BOOL Interp,  /* Interpolate coefs using deltas? */
-                  float *Xp,    /* Current sample */
-                  double Ph,    /* Phase */
-                  int Inc)    /* increment (1 for right wing or -1 for left) */
+/* FilterTables()
+ *
+ * When up-converting without coefficient interpolation, the two wings
+ * only ever use the taps Ph*Npc + k*Npc, so for each phase they can be
+ * laid out ahead of time as one row of contiguous values, the left wing
+ * reversed and the right wing after it, padded with zeros to Wc, and
+ * handed to lrsDot() as they are against the samples from Xp-(W-1) on.
+ * The right phase is 1 minus the left one, so its coeff index is either
+ * Npc-1-p or Npc-p for a left index of p, depending on whether the left
+ * phase fell exactly on p.  Row 2p+1 is for the first case and row 2p for
+ * the second.  The right wing drops its last coeff, as FilterGather()
+ * does below, and never sees the phase 0 special case.
+ */
+
+void lrsFilterTables(float Imp[],  /* impulse response */
+                     UWORD Nwing,  /* len of one wing of filter */
+                     int Wc,       /* taps per row */
+                     float *ImpC)  /* 2*Npc rows */
 {
-   float *Hp, *Hdp = NULL, *End;
-   double a = 0;
-   float v, t;
-
-   Ph *= Npc; /* Npc is number of values per 1/delta in impulse response */
-   
-   v = 0.0; /* The output value */
-   Hp = &Imp[(int)Ph];
-   End = &Imp[Nwing];
-   if (Interp) {
-      Hdp = &ImpD[(int)Ph];
-      a = Ph - floor(Ph); /* fractional part of Phase */
-   }
+   int W = Nwing/Npc;
+   int p, s, r, k, h;
+   float *row;
 
-   if (Inc == 1)		/* If doing right wing...              */
-   {				      /* ...drop extra coeff, so when Ph is  */
-      End--;			/*    0.5, we don't do too many mult's */
-      if (Ph == 0)		/* If the phase is zero...           */
-      {			         /* ...then we've already skipped the */
-         Hp += Npc;		/*    first sample, so we must also  */
-         Hdp += Npc;		/*    skip ahead in Imp[] and ImpD[] */
-      }
-   }
+   for (p=0; p<Npc; p++)
+      for (s=0; s<2; s++) {
+         row = &ImpC[(2*p + s) * Wc];
+         r = Npc - p - s;
 
-   if (Interp)
-      while (Hp < End) {
-         t = *Hp;		/* Get filter coeff */
-         t += (*Hdp)*a; /* t is now interp'd filter coeff */
-         Hdp += Npc;		/* Filter coeff differences step */
-         t *= *Xp;		/* Mult coeff by input sample */
-         v += t;			/* The filter output */
-         Hp += Npc;		/* Filter coeff step */
-         Xp += Inc;		/* Input signal step. NO CHECK ON BOUNDS */
-      } 
-   else 
-      while (Hp < End) {
-         t = *Hp;		/* Get filter coeff */
-         t *= *Xp;		/* Mult coeff by input sample */
-         v += t;			/* The filter output */
-         Hp += Npc;		/* Filter coeff step */
-         Xp += Inc;		/* Input signal step. NO CHECK ON BOUNDS */
+         for (k=0; k<W; k++)
+            row[W-1-k] = Imp[p + k*Npc];
+         for (k=0; k<Wc-W; k++) {
+            h = r + k*Npc;
+            row[W+k] = (k < W && h < Nwing-1)? Imp[h] : 0;
+         }
       }
-   
-   return v;
 }
 
-float lrsFilterUD(float Imp[],  /* impulse response */
-                  float ImpD[], /* impulse response deltas */
-                  UWORD Nwing,  /* len of one wing of filter */
-                  BOOL Interp,  /* Interpolate coefs using deltas? */
-                  float *Xp,    /* Current sample */
-                  double Ph,    /* Phase */
-                  int Inc,    /* increment (1 for right wing or -1 for left) */
-                  double dhb) /* filter sampling period */
+/* FilterGather()
+ *
+ * Collects the (optionally interpolated) coeffs of one wing for a given
+ * phase, sampled every dhb entries of Imp[], into H, which has room for
+ * Hsize of them.  The count is padded with zeros to a multiple of 4 and
+ * returned.  The right wing (Inc 1) is stored from H[0] on.  The left
+ * wing (Inc -1) is stored backwards from H[Hsize-1], with the padding in
+ * front, so that it starts at H[Hsize-count] and lines up with the
+ * samples ending at the current one.  Up-conversion with interpolation
+ * is the same thing with dhb = Npc.
+ */
+
+int lrsFilterGather(float Imp[],  /* impulse response */
+                    float ImpD[], /* impulse response deltas */
+                    UWORD Nwing,  /* len of one wing of filter */
+                    BOOL Interp,  /* Interpolate coefs using deltas? */
+                    double Ph,    /* Phase */
+                    int Inc,    /* increment (1 for right wing or -1 for left) */
+                    double dhb, /* filter sampling period */
+                    float *H,   /* gathered coeffs */
+                    int Hsize)  /* room in H */
 {
-   float a;
-   float *Hp, *Hdp, *End;
-   float v, t;
+   float a, t;
+   float *Hp;
    double Ho;
-    
-   v = 0.0; /* The output value */
+   int End, n, i;
+
    Ho = Ph*dhb;
-   End = &Imp[Nwing];
+   End = Nwing;
+   Hp = H;
    if (Inc == 1)		/* If doing right wing...              */
    {				      /* ...drop extra coeff, so when Ph is  */
       End--;			/*    0.5, we don't do too many mult's */
@@ -190,26 +192,74 @@ float lrsFilterUD(float Imp[],  /* impulse response */
          Ho += dhb;		/* ...then we've already skipped the */
    }				         /*    first sample, so we must also  */
                         /*    skip ahead in Imp[] and ImpD[] */
+   else
+      Hp = &H[Hsize-1];	/* Left wing goes in backwards */
 
+   n = 0;
    if (Interp)
-      while ((Hp = &Imp[(int)Ho]) < End) {
-         t = *Hp;		/* Get IR sample */
-         Hdp = &ImpD[(int)Ho];  /* get interp bits from diff table*/
-         a = Ho - floor(Ho);	  /* a is logically between 0 and 1 */
-         t += (*Hdp)*a; /* t is now interp'd filter coeff */
-         t *= *Xp;		/* Mult coeff by input sample */
-         v += t;			/* The filter output */
+      while ((i = (int)Ho) < End) {
+         t = Imp[i];		/* Get IR sample */
+         a = Ho - i;		/* a is logically between 0 and 1 */
+         t += ImpD[i]*a;	/* t is now interp'd filter coeff */
+         *Hp = t;
+         Hp += Inc;
          Ho += dhb;		/* IR step */
-         Xp += Inc;		/* Input signal step. NO CHECK ON BOUNDS */
+         n++;
       }
-   else 
-      while ((Hp = &Imp[(int)Ho]) < End) {
-         t = *Hp;		/* Get IR sample */
-         t *= *Xp;		/* Mult coeff by input sample */
-         v += t;			/* The filter output */
+   else
+      while ((i = (int)Ho) < End) {
+         *Hp = Imp[i];		/* Get IR sample */
+         Hp += Inc;
          Ho += dhb;		/* IR step */
-         Xp += Inc;		/* Input signal step. NO CHECK ON BOUNDS */
+         n++;
       }
 
-   return v;
+   for (; n & 3; n++) {
+      *Hp = 0;
+      Hp += Inc;
+   }
+
+   return n;
+}
+
+/* Dot()
+ *
+ * sum of H[i]*X[i] for a count n that is a multiple of 4.  Neither
+ * pointer has to be aligned.
+ */
+
+float lrsDot(const float *H, const float *X, int n)
+{
+   int i;
+
+#if LRS_SSE
+   __m128 acc = _mm_setzero_ps();
+
+   for (i=0; i<n; i+=4)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(H+i), _mm_loadu_ps(X+i)));
+
+   acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+   acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+   return _mm_cvtss_f32(acc);
+#elif LRS_NEON
+   float32x4_t acc = vdupq_n_f32(0);
+   float32x2_t sum;
+
+   for (i=0; i<n; i+=4)
+      acc = vmlaq_f32(acc, vld1q_f32(H+i), vld1q_f32(X+i));
+
+   sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+   return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+   float v0 = 0, v1 = 0, v2 = 0, v3 = 0;
+
+   for (i=0; i<n; i+=4) {
+      v0 += H[i]*X[i];
+      v1 += H[i+1]*X[i+1];
+      v2 += H[i+2]*X[i+2];
+      v3 += H[i+3]*X[i+3];
+   }
+
+   return (v0 + v1) + (v2 + v3);
+#endif
 }
@@ -15,14 +15,17 @@
 #include "resample_defs.h"
 
 /*
- * FilterUp() - Applies a filter to a given sample when up-converting.
- * FilterUD() - Applies a filter to a given sample when up- or down-
+ * lrsLpFilter()     - Computes the coeffs of a Kaiser-windowed low pass filter
+ * lrsFilterTables() - Lays the coeffs out as polyphase rows for up-conversion
+ * lrsFilterGather() - Collects the coeffs one wing needs at a given phase
+ * lrsDot()          - Inner product of coeffs and samples, 4 at a time
  */
 
-float lrsFilterUp(float Imp[], float ImpD[], UWORD Nwing, BOOL Interp,
-                  float *Xp, double Ph, int Inc);
+void lrsLpFilter(double c[], int N, double frq, double Beta, int Num);
 
-float lrsFilterUD(float Imp[], float ImpD[], UWORD Nwing, BOOL Interp,
-                  float *Xp, double Ph, int Inc, double dhb);
+void lrsFilterTables(float Imp[], UWORD Nwing, int Wc, float *ImpC);
 
-void lrsLpFilter(double c[], int N, double frq, double Beta, int Num);
+int lrsFilterGather(float Imp[], float ImpD[], UWORD Nwing, BOOL Interp,
+                    double Ph, int Inc, double dhb, float *H, int Hsize);
+
+float lrsDot(const float *H, const float *X, int n);
@@ -28,62 +28,82 @@
 #include <string.h>
 
 typedef struct {
-   float  *Imp;
-   float  *ImpD;
+   lrsFilter filt;
    float   LpScl;
    UWORD   Nmult;
-   UWORD   Nwing;
    double  minFactor;
    double  maxFactor;
+   int     nch;
    UWORD   XSize;
-   float  *X;
+   float  *X[MAXCHANNELS];
    UWORD   Xp; /* Current "now"-sample pointer for input */
    UWORD   Xread; /* Position to put new samples */
    UWORD   Xoff;
    UWORD   YSize;
-   float  *Y;
+   float  *Y[MAXCHANNELS];
    UWORD   Yp;
    double  Time;
 } rsdata;
 
+static float *dup_floats(const float *src, int len)
+{
+   float *dst = (float *)malloc(len * sizeof(float));
+   memcpy(dst, src, len * sizeof(float));
+   return dst;
+}
+
 void *resample_dup(const void *	handle)
 {
    const rsdata *cpy = (const rsdata *)handle;
    rsdata *hp = (rsdata *)malloc(sizeof(rsdata));
+   const lrsFilter *cf = &cpy->filt;
+   lrsFilter *f = &hp->filt;
+   int c;
 
    hp->minFactor = cpy->minFactor;
    hp->maxFactor = cpy->maxFactor;
    hp->Nmult = cpy->Nmult;
    hp->LpScl = cpy->LpScl;
-   hp->Nwing = cpy->Nwing;
+   hp->nch = cpy->nch;
 
-   hp->Imp = (float *)malloc(hp->Nwing * sizeof(float));
-   memcpy(hp->Imp, cpy->Imp, hp->Nwing * sizeof(float));
-   hp->ImpD = (float *)malloc(hp->Nwing * sizeof(float));
-   memcpy(hp->ImpD, cpy->ImpD, hp->Nwing * sizeof(float));
+   f->Nwing = cf->Nwing;
+   f->Imp = dup_floats(cf->Imp, f->Nwing);
+   f->ImpD = dup_floats(cf->ImpD, f->Nwing);
+   f->Wc = cf->Wc;
+   f->ImpC = dup_floats(cf->ImpC, 2 * Npc * f->Wc);
+   f->Hsize = cf->Hsize;
+   f->H = (float *)malloc(2 * f->Hsize * sizeof(float));
 
    hp->Xoff = cpy->Xoff;
    hp->XSize = cpy->XSize;
-   hp->X = (float *)malloc((hp->XSize + hp->Xoff) * sizeof(float));
-   memcpy(hp->X, cpy->X, (hp->XSize + hp->Xoff) * sizeof(float));
    hp->Xp = cpy->Xp;
    hp->Xread = cpy->Xread;
    hp->YSize = cpy->YSize;
-   hp->Y = (float *)malloc(hp->YSize * sizeof(float));
-   memcpy(hp->Y, cpy->Y, hp->YSize * sizeof(float));
    hp->Yp = cpy->Yp;
    hp->Time = cpy->Time;
+
+   for(c=0; c<hp->nch; c++) {
+      hp->X[c] = dup_floats(cpy->X[c], hp->XSize + hp->Xoff);
+      hp->Y[c] = dup_floats(cpy->Y[c], hp->YSize);
+   }
    
    return (void *)hp;
 }
 
 void *resample_open(int highQuality, double minFactor, double maxFactor)
+{
+   return resample_open_channels(highQuality, minFactor, maxFactor, 1);
+}
+
+void *resample_open_channels(int highQuality, double minFactor,
+                             double maxFactor, int channels)
 {
    double *Imp64;
    double Rolloff, Beta;
    rsdata *hp;
+   lrsFilter *f;
    UWORD   Xoff_min, Xoff_max;
-   int i;
+   int i, c;
 
    /* Just exit if we get invalid factors */
    if (minFactor <= 0.0 || maxFactor <= 0.0 || maxFactor < minFactor) {
@@ -96,10 +116,21 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
       return 0;
    }
 
+   if (channels < 1 || channels > MAXCHANNELS) {
+      #if DEBUG
+      fprintf(stderr,
+              "libresample: "
+              "channels must be between 1 and %d.\n", MAXCHANNELS);
+      #endif
+      return 0;
+   }
+
    hp = (rsdata *)malloc(sizeof(rsdata));
+   f = &hp->filt;
 
    hp->minFactor = minFactor;
    hp->maxFactor = maxFactor;
+   hp->nch = channels;
  
    if (highQuality)
       hp->Nmult = 35;
@@ -107,30 +138,39 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
       hp->Nmult = 11;
 
    hp->LpScl = 1.0;
-   hp->Nwing = Npc*(hp->Nmult-1)/2; /* # of filter coeffs in right wing */
+   f->Nwing = Npc*(hp->Nmult-1)/2; /* # of filter coeffs in right wing */
 
    Rolloff = 0.90;
    Beta = 6;
 
-   Imp64 = (double *)malloc(hp->Nwing * sizeof(double));
+   Imp64 = (double *)malloc(f->Nwing * sizeof(double));
 
-   lrsLpFilter(Imp64, hp->Nwing, 0.5*Rolloff, Beta, Npc);
+   lrsLpFilter(Imp64, f->Nwing, 0.5*Rolloff, Beta, Npc);
 
-   hp->Imp = (float *)malloc(hp->Nwing * sizeof(float));
-   hp->ImpD = (float *)malloc(hp->Nwing * sizeof(float));
-   for(i=0; i<hp->Nwing; i++)
-      hp->Imp[i] = Imp64[i];
+   f->Imp = (float *)malloc(f->Nwing * sizeof(float));
+   f->ImpD = (float *)malloc(f->Nwing * sizeof(float));
+   for(i=0; i<f->Nwing; i++)
+      f->Imp[i] = Imp64[i];
 
    /* Storing deltas in ImpD makes linear interpolation
       of the filter coefficients faster */
-   for (i=0; i<hp->Nwing-1; i++)
-      hp->ImpD[i] = hp->Imp[i+1] - hp->Imp[i];
+   for (i=0; i<f->Nwing-1; i++)
+      f->ImpD[i] = f->Imp[i+1] - f->Imp[i];
 
    /* Last coeff. not interpolated */
-   hp->ImpD[hp->Nwing-1] = - hp->Imp[hp->Nwing-1];
+   f->ImpD[f->Nwing-1] = - f->Imp[f->Nwing-1];
 
    free(Imp64);
 
+   /* Lay out the polyphase rows the up-conversion path reads, and
+      make room for the coeffs of both wings when down-converting */
+   f->Wc = ((hp->Nmult-1) + 3) & ~3;
+   f->ImpC = (float *)malloc(2 * Npc * f->Wc * sizeof(float));
+   lrsFilterTables(f->Imp, f->Nwing, f->Wc, f->ImpC);
+
+   f->Hsize = ((int)(((hp->Nmult-1)/2) * MAX(1.0, 1.0/minFactor)) + 8) & ~3;
+   f->H = (float *)malloc(2 * f->Hsize * sizeof(float));
+
    /* Calc reach of LP filter wing (plus some creeping room) */
    Xoff_min = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/minFactor) + 10;
    Xoff_max = ((hp->Nmult+1)/2.0) * MAX(1.0, 1.0/maxFactor) + 10;
@@ -142,20 +182,23 @@ void *resample_open(int highQuality, double minFactor, double maxFactor)
       we can zero-pad up to Xoff zeros at the end when we reach the
       end of the input samples. */
    hp->XSize = MAX(2*hp->Xoff+10, 4096);
-   hp->X = (float *)malloc((hp->XSize + hp->Xoff) * sizeof(float));
    hp->Xp = hp->Xoff;
    hp->Xread = hp->Xoff;
-   
-   /* Need Xoff zeros at begining of X buffer */
-   for(i=0; i<hp->Xoff; i++)
-      hp->X[i]=0;
 
    /* Make the outBuffer long enough to hold the entire processed
       output of one inBuffer */
    hp->YSize = (int)(((double)hp->XSize)*maxFactor+2.0);
-   hp->Y = (float *)malloc(hp->YSize * sizeof(float));
    hp->Yp = 0;
 
+   for(c=0; c<channels; c++) {
+      hp->X[c] = (float *)malloc((hp->XSize + hp->Xoff) * sizeof(float));
+      hp->Y[c] = (float *)malloc(hp->YSize * sizeof(float));
+
+      /* Need Xoff zeros at begining of X buffer */
+      for(i=0; i<hp->Xoff; i++)
+         hp->X[c][i]=0;
+   }
+
    hp->Time = (double)hp->Xoff; /* Current-time pointer for converter */
    
    return (void *)hp;
@@ -175,17 +218,52 @@ int resample_process(void   *handle,
                      int    *inBufferUsed, /* output param */
                      float  *outBuffer,
                      int     outBufferLen)
+{
+   return resample_process_interleaved(handle, factor,
+                                       inBuffer, inBufferLen,
+                                       lastFlag, inBufferUsed,
+                                       outBuffer, outBufferLen);
+}
+
+/* Buffers hold interleaved frames of hp->nch samples from here on, and
+   all lengths and counts are in frames */
+
+static int copy_out(rsdata *hp, float *outBuffer, int outSampleCount,
+                    int outBufferLen)
+{
+   int nch = hp->nch;
+   int i, c, len;
+
+   len = MIN(outBufferLen-outSampleCount, hp->Yp);
+   for(c=0; c<nch; c++) {
+      float *Y = hp->Y[c];
+      for(i=0; i<len; i++)
+         outBuffer[(outSampleCount+i)*nch + c] = Y[i];
+      for(i=0; i<hp->Yp-len; i++)
+         Y[i] = Y[i+len];
+   }
+   hp->Yp -= len;
+
+   return outSampleCount + len;
+}
+
+int resample_process_interleaved(void   *handle,
+                                 double  factor,
+                                 float  *inBuffer,
+                                 int     inBufferLen,
+                                 int     lastFlag,
+                                 int    *inBufferUsed, /* output param */
+                                 float  *outBuffer,
+                                 int     outBufferLen)
 {
    rsdata *hp = (rsdata *)handle;
-   float  *Imp = hp->Imp;
-   float  *ImpD = hp->ImpD;
    float  LpScl = hp->LpScl;
-   UWORD  Nwing = hp->Nwing;
+   int    nch = hp->nch;
    BOOL interpFilt = FALSE; /* TRUE means interpolate filter coeffs */
    int outSampleCount;
    UWORD Nout, Ncreep, Nreuse;
    int Nx;
-   int i, len;
+   int i, c, len;
 
    #if DEBUG
    fprintf(stderr, "resample_process: in=%d, out=%d lastFlag=%d\n",
@@ -208,15 +286,8 @@ int resample_process(void   *handle,
 
    /* Start by copying any samples still in the Y buffer to the output
       buffer */
-   if (hp->Yp && (outBufferLen-outSampleCount)>0) {
-      len = MIN(outBufferLen-outSampleCount, hp->Yp);
-      for(i=0; i<len; i++)
-         outBuffer[outSampleCount+i] = hp->Y[i];
-      outSampleCount += len;
-      for(i=0; i<hp->Yp-len; i++)
-         hp->Y[i] = hp->Y[i+len];
-      hp->Yp -= len;
-   }
+   if (hp->Yp && (outBufferLen-outSampleCount)>0)
+      outSampleCount = copy_out(hp, outBuffer, outSampleCount, outBufferLen);
 
    /* If there are still output samples left, return now - we need
       the full output buffer available to us... */
@@ -243,8 +314,9 @@ int resample_process(void   *handle,
       if (len >= (inBufferLen - (*inBufferUsed)))
          len = (inBufferLen - (*inBufferUsed));
 
-      for(i=0; i<len; i++)
-         hp->X[hp->Xread + i] = inBuffer[(*inBufferUsed) + i];
+      for(c=0; c<nch; c++)
+         for(i=0; i<len; i++)
+            hp->X[c][hp->Xread + i] = inBuffer[((*inBufferUsed) + i)*nch + c];
 
       *inBufferUsed += len;
       hp->Xread += len;
@@ -254,8 +326,9 @@ int resample_process(void   *handle,
             end of the input buffer and make sure we process
             all the way to the end */
          Nx = hp->Xread - hp->Xoff;
-         for(i=0; i<hp->Xoff; i++)
-            hp->X[hp->Xread + i] = 0;
+         for(c=0; c<nch; c++)
+            for(i=0; i<hp->Xoff; i++)
+               hp->X[c][hp->Xread + i] = 0;
       }
       else
          Nx = hp->Xread - 2 * hp->Xoff;
@@ -269,12 +342,12 @@ int resample_process(void   *handle,
 
       /* Resample stuff in input buffer */
       if (factor >= 1) {      /* SrcUp() is faster if we can use it */
-         Nout = lrsSrcUp(hp->X, hp->Y, factor, &hp->Time, Nx,
-                         Nwing, LpScl, Imp, ImpD, interpFilt);
+         Nout = lrsSrcUp(hp->X, hp->Y, nch, factor, &hp->Time, Nx,
+                         LpScl, &hp->filt, interpFilt);
       }
       else {
-         Nout = lrsSrcUD(hp->X, hp->Y, factor, &hp->Time, Nx,
-                         Nwing, LpScl, Imp, ImpD, interpFilt);
+         Nout = lrsSrcUD(hp->X, hp->Y, nch, factor, &hp->Time, Nx,
+                         LpScl, &hp->filt, interpFilt);
       }
 
       #ifdef DEBUG
@@ -294,8 +367,9 @@ int resample_process(void   *handle,
       /* Copy part of input signal that must be re-used */
       Nreuse = hp->Xread - (hp->Xp - hp->Xoff);
 
-      for (i=0; i<Nreuse; i++)
-         hp->X[i] = hp->X[i + (hp->Xp - hp->Xoff)];
+      for(c=0; c<nch; c++)
+         for (i=0; i<Nreuse; i++)
+            hp->X[c][i] = hp->X[c][i + (hp->Xp - hp->Xoff)];
 
       #ifdef DEBUG
       printf("New Xread=%d\n", Nreuse);
@@ -316,15 +390,9 @@ int resample_process(void   *handle,
       hp->Yp = Nout;
 
       /* Copy as many samples as possible to the output buffer */
-      if (hp->Yp && (outBufferLen-outSampleCount)>0) {
-         len = MIN(outBufferLen-outSampleCount, hp->Yp);
-         for(i=0; i<len; i++)
-            outBuffer[outSampleCount+i] = hp->Y[i];
-         outSampleCount += len;
-         for(i=0; i<hp->Yp-len; i++)
-            hp->Y[i] = hp->Y[i+len];
-         hp->Yp -= len;
-      }
+      if (hp->Yp && (outBufferLen-outSampleCount)>0)
+         outSampleCount = copy_out(hp, outBuffer, outSampleCount,
+                                   outBufferLen);
 
       /* If there are still output samples left, return now,
          since we need the full output buffer available */
@@ -338,10 +406,14 @@ int resample_process(void   *handle,
 void resample_close(void *handle)
 {
    rsdata *hp = (rsdata *)handle;
-   free(hp->X);
-   free(hp->Y);
-   free(hp->Imp);
-   free(hp->ImpD);
+   int c;
+   for(c=0; c<hp->nch; c++) {
+      free(hp->X[c]);
+      free(hp->Y[c]);
+   }
+   free(hp->filt.Imp);
+   free(hp->filt.ImpD);
+   free(hp->filt.ImpC);
+   free(hp->filt.H);
    free(hp);
 }
-
@@ -73,14 +73,37 @@
 
 #define Npc 4096
 
+/* Vector units used for the filter inner products, unless built
+   with NO_SIMD (configure --disable-simd) */
+
+#if !defined(NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+  #define LRS_SSE 1
+#elif !defined(NO_SIMD) && defined(__ARM_NEON)
+  #define LRS_NEON 1
+#endif
+
+/* Largest number of channels one handle can carry */
+
+#define MAXCHANNELS 8
+
+/* The filter, plus the tables and scratch derived from it */
+
+typedef struct {
+   float  *Imp;     /* right wing of the impulse response */
+   float  *ImpD;    /* deltas between neighbouring Imp values */
+   UWORD   Nwing;   /* # of filter coeffs in the right wing */
+   int     Wc;      /* taps per polyphase row, a multiple of 4 */
+   float  *ImpC;    /* 2*Npc rows of both wings, see lrsFilterTables */
+   int     Hsize;   /* room in H for one wing when down-converting */
+   float  *H;       /* coeffs gathered for the current output */
+} lrsFilter;
+
 /* Function prototypes */
 
-int lrsSrcUp(float X[], float Y[], double factor, double *Time,
-             UWORD Nx, UWORD Nwing, float LpScl,
-             float Imp[], float ImpD[], BOOL Interp);
+int lrsSrcUp(float *X[], float *Y[], int nch, double factor, double *Time,
+             UWORD Nx, float LpScl, lrsFilter *f, BOOL Interp);
 
-int lrsSrcUD(float X[], float Y[], double factor, double *Time,
-             UWORD Nx, UWORD Nwing, float LpScl,
-             float Imp[], float ImpD[], BOOL Interp);
+int lrsSrcUD(float *X[], float *Y[], int nch, double factor, double *Time,
+             UWORD Nx, float LpScl, lrsFilter *f, BOOL Interp);
 
 #endif
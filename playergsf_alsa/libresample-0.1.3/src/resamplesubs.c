@@ -24,22 +24,29 @@
 #include <math.h>
 #include <string.h>
 
+/* Both subroutines run every channel of a handle through the same pass:
+ * the time step, the phase and the coefficients are worked out once per
+ * output, and only the inner products are done per channel.
+ */
+
 /* Sampling rate up-conversion only subroutine;
  * Slightly faster than down-conversion;
  */
-int lrsSrcUp(float X[],
-             float Y[],
+int lrsSrcUp(float *X[],
+             float *Y[],
+             int nch,
              double factor,
              double *TimePtr,
              UWORD Nx,
-             UWORD Nwing,
              float LpScl,
-             float Imp[],
-             float ImpD[],
+             lrsFilter *f,
              BOOL Interp)
 {
-    float *Xp, *Ystart;
+    float *Hl, *Hr;
     float v;
+    int Nl, Nr, Xi, c;
+    int W = f->Nwing/Npc;      /* taps in one wing */
+    int Nout = 0;
     
     double CurrentTime = *TimePtr;
     double dt;                 /* Step through input signal */ 
@@ -47,46 +54,71 @@ int lrsSrcUp(float X[],
     
     dt = 1.0/factor;           /* Output sampling period */
     
-    Ystart = Y;
     endTime = CurrentTime + Nx;
     while (CurrentTime < endTime)
     {
         double LeftPhase = CurrentTime-floor(CurrentTime);
         double RightPhase = 1.0 - LeftPhase;
 
-        Xp = &X[(int)CurrentTime]; /* Ptr to current input sample */
-        /* Perform left-wing inner product */
-        v = lrsFilterUp(Imp, ImpD, Nwing, Interp, Xp,
-                        LeftPhase, -1);
-        /* Perform right-wing inner product */
-        v += lrsFilterUp(Imp, ImpD, Nwing, Interp, Xp+1, 
-                         RightPhase, 1);
-
-        v *= LpScl;   /* Normalize for unity filter gain */
-
-        *Y++ = v;               /* Deposit output */
+        Xi = (int)CurrentTime; /* Index of current input sample */
+
+        if (Interp) {
+            Hr = f->H + f->Hsize;
+            Nl = lrsFilterGather(f->Imp, f->ImpD, f->Nwing, Interp,
+                                 LeftPhase, -1, Npc, f->H, f->Hsize);
+            Nr = lrsFilterGather(f->Imp, f->ImpD, f->Nwing, Interp,
+                                 RightPhase, 1, Npc, Hr, f->Hsize);
+            Hl = &f->H[f->Hsize - Nl];
+
+            for (c=0; c<nch; c++) {
+                /* Left-wing inner product, ending at the current sample */
+                v = lrsDot(Hl, &X[c][Xi-Nl+1], Nl);
+                /* Right-wing inner product */
+                v += lrsDot(Hr, &X[c][Xi+1], Nr);
+
+                v *= LpScl;   /* Normalize for unity filter gain */
+                Y[c][Nout] = v;     /* Deposit output */
+            }
+        }
+        else {
+            /* Both wings at once, from the row for this phase */
+            int Ph = (int)(LeftPhase*Npc);
+            int Rh = (int)(RightPhase*Npc);
+
+            Hl = &f->ImpC[(2*Ph + (Rh == Npc-1-Ph)) * f->Wc];
+
+            for (c=0; c<nch; c++) {
+                v = lrsDot(Hl, &X[c][Xi-W+1], f->Wc);
+
+                v *= LpScl;   /* Normalize for unity filter gain */
+                Y[c][Nout] = v;     /* Deposit output */
+            }
+        }
+
+        Nout++;
         CurrentTime += dt;      /* Move to next sample by time increment */
     }
 
     *TimePtr = CurrentTime;
-    return (Y - Ystart);        /* Return the number of output samples */
+    return Nout;               /* Return the number of output samples */
 }
 
 /* Sampling rate conversion subroutine */
 
-int lrsSrcUD(float X[],
-             float Y[],
+int lrsSrcUD(float *X[],
+             float *Y[],
+             int nch,
              double factor,
              double *TimePtr,
              UWORD Nx,
-             UWORD Nwing,
              float LpScl,
-             float Imp[],
-             float ImpD[],
+             lrsFilter *f,
              BOOL Interp)
 {
-    float *Xp, *Ystart;
+    float *Hl, *Hr;
     float v;
+    int Nl, Nr, Xi, c;
+    int Nout = 0;
 
     double CurrentTime = (*TimePtr);
     double dh;                 /* Step through filter impulse response */
@@ -97,27 +129,35 @@ int lrsSrcUD(float X[],
     
     dh = MIN(Npc, factor*Npc);  /* Filter sampling period */
     
-    Ystart = Y;
+    Hr = f->H + f->Hsize;
+
     endTime = CurrentTime + Nx;
     while (CurrentTime < endTime)
     {
         double LeftPhase = CurrentTime-floor(CurrentTime);
         double RightPhase = 1.0 - LeftPhase;
 
-        Xp = &X[(int)CurrentTime];     /* Ptr to current input sample */
-        /* Perform left-wing inner product */
-        v = lrsFilterUD(Imp, ImpD, Nwing, Interp, Xp,
-                        LeftPhase, -1, dh);
-        /* Perform right-wing inner product */
-        v += lrsFilterUD(Imp, ImpD, Nwing, Interp, Xp+1, 
-                         RightPhase, 1, dh);
-
-        v *= LpScl;   /* Normalize for unity filter gain */
-        *Y++ = v;               /* Deposit output */
-        
+        Xi = (int)CurrentTime;     /* Index of current input sample */
+        Nl = lrsFilterGather(f->Imp, f->ImpD, f->Nwing, Interp,
+                             LeftPhase, -1, dh, f->H, f->Hsize);
+        Nr = lrsFilterGather(f->Imp, f->ImpD, f->Nwing, Interp,
+                             RightPhase, 1, dh, Hr, f->Hsize);
+        Hl = &f->H[f->Hsize - Nl];
+
+        for (c=0; c<nch; c++) {
+            /* Left-wing inner product, ending at the current sample */
+            v = lrsDot(Hl, &X[c][Xi-Nl+1], Nl);
+            /* Right-wing inner product */
+            v += lrsDot(Hr, &X[c][Xi+1], Nr);
+
+            v *= LpScl;   /* Normalize for unity filter gain */
+            Y[c][Nout] = v;     /* Deposit output */
+        }
+
+        Nout++;
         CurrentTime += dt;      /* Move to next sample by time increment */
     }
 
     *TimePtr = CurrentTime;
-    return (Y - Ystart);        /* Return the number of output samples */
+    return Nout;               /* Return the number of output samples */
 }
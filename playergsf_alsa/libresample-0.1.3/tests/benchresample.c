@@ -0,0 +1,156 @@
+/**********************************************************************
+
+  benchresample.c
+
+  Real-time library interface by Dominic Mazzoni
+
+  Based on resample-1.7:
+    http://www-ccrma.stanford.edu/~jos/resample/
+
+  License: LGPL - see the file LICENSE.txt for more information
+
+  Reports how many input samples per second get through the library
+  at a range of factors, for a mono handle, for a stereo signal done
+  as two mono handles, and for the same signal done interleaved.
+
+**********************************************************************/
+
+#include "../include/libresample.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/time.h>
+
+#define MIN(A, B) ((A) < (B)? (A) : (B))
+#define MAX(A, B) ((A) > (B)? (A) : (B))
+
+#define SRCLEN   65536
+#define BLOCKLEN 512
+
+static double now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Resamples srclen frames of nch interleaved channels in blocks, the
+   way a player would feed it, and returns the number of frames out */
+static int run(void *handle, int nch, double factor,
+               float *src, int srclen, float *dst, int dstlen)
+{
+   int out = 0, srcpos = 0, o, srcused;
+
+   for(;;) {
+      int srcBlock = MIN(srclen-srcpos, BLOCKLEN);
+      int lastFlag = (srcBlock == srclen-srcpos);
+
+      o = resample_process_interleaved(handle, factor,
+                                       &src[srcpos*nch], srcBlock,
+                                       lastFlag, &srcused,
+                                       &dst[out*nch], dstlen-out);
+      srcpos += srcused;
+      if (o >= 0)
+         out += o;
+      if (o < 0 || (o == 0 && srcpos == srclen))
+         break;
+   }
+
+   return out;
+}
+
+static void runtest(int highQuality, double factor, int passes)
+{
+   int dstlen = (int)(SRCLEN * factor) + 1000;
+   float *mono = (float *)malloc(SRCLEN * sizeof(float));
+   float *right = (float *)malloc(SRCLEN * sizeof(float));
+   float *stereo = (float *)malloc(2 * SRCLEN * sizeof(float));
+   float *dst = (float *)malloc(dstlen * sizeof(float));
+   float *dst2 = (float *)malloc(dstlen * sizeof(float));
+   float *dsts = (float *)malloc(2 * dstlen * sizeof(float));
+   double t0, tmono, tpair, tinter;
+   double maxdiff = 0;
+   void *handle, *handle2;
+   int i, p, out = 0, out2 = 0, outs = 0;
+
+   for(i=0; i<SRCLEN; i++) {
+      mono[i] = stereo[i*2] = sin(i/100.0);
+      right[i] = stereo[i*2+1] = sin(i/37.0) * 0.5;
+   }
+
+   /* building the filter is left out of the timings, it happens once */
+   tmono = tpair = tinter = 0;
+   for(p=0; p<passes; p++) {
+      handle = resample_open(highQuality, factor, factor);
+      t0 = now();
+      out = run(handle, 1, factor, mono, SRCLEN, dst, dstlen);
+      tmono += now() - t0;
+      resample_close(handle);
+
+      handle = resample_open(highQuality, factor, factor);
+      handle2 = resample_open(highQuality, factor, factor);
+      t0 = now();
+      out = run(handle, 1, factor, mono, SRCLEN, dst, dstlen);
+      out2 = run(handle2, 1, factor, right, SRCLEN, dst2, dstlen);
+      tpair += now() - t0;
+      resample_close(handle);
+      resample_close(handle2);
+
+      handle = resample_open_channels(highQuality, factor, factor, 2);
+      t0 = now();
+      outs = run(handle, 2, factor, stereo, SRCLEN, dsts, dstlen);
+      tinter += now() - t0;
+      resample_close(handle);
+   }
+
+   /* the interleaved pass has to give the same as the two handles */
+   if (outs != out || outs != out2)
+      printf("   Error: interleaved gave %d frames, mono gave %d and %d\n",
+             outs, out, out2);
+   for(i=0; i<MIN(outs, out); i++) {
+      maxdiff = MAX(maxdiff, fabs(dsts[i*2] - dst[i]));
+      maxdiff = MAX(maxdiff, fabs(dsts[i*2+1] - dst2[i]));
+   }
+   if (maxdiff > 0)
+      printf("   Error: interleaved differs from mono by up to %g\n",
+             maxdiff);
+
+   printf("%s  %6.3f  %10.0f  %10.0f  %10.0f\n",
+          highQuality? "high" : "low ", factor,
+          passes * (double)SRCLEN / tmono,
+          passes * 2.0 * SRCLEN / tpair,
+          passes * 2.0 * SRCLEN / tinter);
+
+   free(mono);
+   free(right);
+   free(stereo);
+   free(dst);
+   free(dst2);
+   free(dsts);
+}
+
+int main(int argc, char **argv)
+{
+   static const double factors[] = {
+      0.25, 0.5, 0.9, 1.0, 1.5, 2.0, 44100.0/13379.0, 4.0, 8.0
+   };
+   int passes = (argc > 1)? atoi(argv[1]) : 4;
+   int q, i;
+
+   if (passes < 1)
+      passes = 1;
+
+   printf("Input samples per second, %d frames in blocks of %d, "
+          "%d passes\n\n", SRCLEN, BLOCKLEN, passes);
+   printf("qual  factor        mono   2 x mono  interleaved\n");
+
+   for(q=0; q<2; q++)
+      for(i=0; i<(int)(sizeof(factors)/sizeof(factors[0])); i++)
+         runtest(q, factors[i], passes);
+
+   return 0;
+}
@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <libgen.h>
 #include <chrono>
@@ -12,8 +15,8 @@
 #include <alsa/asoundlib.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <time.h>
-#include <mutex>
 #include <string>
 #include <math.h>
 
@@ -25,6 +28,16 @@ extern "C" {
 #include "VBA/psftag.h"
 #include "gsf.h"
 }
+#include "VBA/archive.h"
+#include "VBA/lazyrom.h"
+#include "VBA/shmrom.h"
+#include "VBA/snapshot.h"
+#include "VBA/loopfind.h"
+#include "VBA/snd_interp.h"
+#include "VBA/snd_fir.h"
+#include "VBA/snd_dsp.h"
+#include "scope.h"
+#include "status.h"
 
 extern "C" {
 int defvolume=1000;
@@ -44,7 +57,7 @@ int sndBitsPerSample=16;
 int bass_boost_enabled = 0;
 
 int deflen=120,deffade=10;
-#define W 800
+#define W SCOPE_WIDTH
 int draw_buf[2][6][2*W];
 int n_old[2][6];
 // Draw buf starts full, all samples are 0
@@ -53,18 +66,21 @@ int last[2][6] = {
 	{2*W, 2*W, 2*W, 2*W, 2*W, 2*W},
 };
 
-// Coeficientes filtro low-shelf
-static float b0_ls, b1_ls, b2_ls, a1_ls, a2_ls;
+int curr_buf;
 
-// Estados del filtro para canal L y R
-static float x1L=0, x2L=0, y1L=0, y2L=0;
-static float x1R=0, x2R=0, y1R=0, y2R=0;
+// the file of -O, and whether the channels are captured into it at all
+static scope_block *scope;
+static int scope_enabled = 0;
 
-int curr_buf;
-std::mutex bufmtx;
+// the file of -T, and what goes into it that the rest of the player doesn't keep
+static play_status *status;
+static unsigned long long status_written;	// samples handed to the device this track
+static unsigned int status_xruns;
+static unsigned int status_speed;
 
 extern unsigned short soundFinalWave[1470];
 extern int soundBufferLen;
+extern int soundBufferIndex;
 extern int soundIndex;
 extern int8_t soundBuffer[4][735];
 extern uint8_t *ioMem;
@@ -80,16 +96,56 @@ extern char soundEcho;
 extern char soundLowPass;
 extern char soundReverse;
 extern char soundQuality;
+extern "C" int soundInterpolation;
+extern "C" int soundNativeMix;
+extern "C" int soundSeekTicks;
+extern "C" int SOUND_CLOCK_TICKS;
+extern void soundSeek(int);
 
 double decode_pos_ms; // current decoding position, in milliseconds
 int seek_needed; // if != -1, it is the point that the decode thread should seek to, in ms.
+static int start_ms = -1;	// -S, where the first track starts
+static int keyframe_interval = 10;	// -K, in seconds
+static const char *resume_path;	// -R
+static int analyse = 0;	// -a, and 2 with -u
+
+#define ANALYSE_EVERY	10		// seconds of the track between looks for its loop
+#define ANALYSE_MAX		(15 * 60)	// and the most of it rendered
 
 static int g_playing = 0;
 static int g_must_exit = 0;
+static int g_control = 0;
+static int g_paused = 0;
+static int g_keep = 0;	// stopped by "keep", which wants the state kept
 
 static snd_pcm_t *pcm_handle;
-static snd_pcm_hw_params_t *hw_params;
 static snd_pcm_uframes_t frames;
+static int pcm_mmap = 0;	// the device ring is written in place rather than through writei
+static int pcm_can_pause = 0;
+
+// a device that can't pause is stopped instead, and what it still held when it was is
+// played again from here on resume; so it keeps the last buffer's worth it was given
+static char *pcm_history;
+static snd_pcm_uframes_t pcm_history_frames, pcm_history_at, pcm_replay;
+static size_t pcm_frame_bytes;
+static const char *pcm_device = "default";
+static snd_pcm_format_t pcm_format = SND_PCM_FORMAT_S16_LE;
+static unsigned int pcm_rate = 44100;
+
+// how much is buffered, and how empty the buffer gets before the player is woken to fill
+// it again. the power saving profile renders a long buffer in one burst and then lets
+// the CPU sleep in poll() for most of it, rather than waking for every period
+static const struct {
+	unsigned int buffer_ms;
+	unsigned int period_ms;
+	unsigned int wake;		// percent of the buffer free; 0 for a period
+} pcm_profiles[] = {
+	{ 30, 5, 0 },			// low latency
+	{ 93, 23, 0 },			// 4096/1024 frames at 44.1 kHz, as it always was
+	{ 500, 125, 75 },		// power saving
+};
+#define PCM_PROFILES (int)(sizeof(pcm_profiles) / sizeof(pcm_profiles[0]))
+static int pcm_profile = 1;
 
 extern "C" int LengthFromString(const char * timestring);
 extern "C" int VolumeFromString(const char * volumestring);
@@ -144,48 +200,150 @@ void updateBuf(int c, int ch, float m, T *data, int datalen) {
     last[!c][ch] = n_old[!c][ch] + datalen;
     assert(last[!c][ch] >= W);
 }
-static void lowshelf_init(float fs, float f0, float gainDB) {
-    float A  = powf(10.0f, gainDB / 40.0f);
-    float w0 = 2.0f * M_PI * f0 / fs;
-    float alpha = sinf(w0) / 2.0f * sqrtf( (A + 1/A) * (1.0f/0.707f - 1.0f) + 2.0f );
-    float k = cosf(w0);
-
-    float b0f =    A*((A+1) - (A-1)*k + 2.0f*sqrtf(A)*alpha);
-    float b1f =  2*A*((A-1) - (A+1)*k);
-    float b2f =    A*((A+1) - (A-1)*k - 2.0f*sqrtf(A)*alpha);
-    float a0f =       (A+1) + (A-1)*k + 2.0f*sqrtf(A)*alpha;
-    float a1f =  -2*((A-1) + (A+1)*k);
-    float a2f =       (A+1) + (A-1)*k - 2.0f*sqrtf(A)*alpha;
-
-    b0_ls = b0f / a0f;
-    b1_ls = b1f / a0f;
-    b2_ls = b2f / a0f;
-    a1_ls = a1f / a0f;
-    a2_ls = a2f / a0f;
-}
-static void lowshelf_process(short *samples, int count) {
-    for (int i = 0; i < count; i += 2) {
-        float inL = samples[i];
-        float inR = samples[i+1];
-
-        float outL = b0_ls*inL + b1_ls*x1L + b2_ls*x2L - a1_ls*y1L - a2_ls*y2L;
-        float outR = b0_ls*inR + b1_ls*x1R + b2_ls*x2R - a1_ls*y1R - a2_ls*y2R;
-
-        x2L = x1L; x1L = inL; y2L = y1L; y1L = outL;
-        x2R = x1R; x1R = inR; y2R = y1R; y1R = outR;
-
-        if (outL > 32767.0f) outL = 32767.0f;
-        if (outL < -32768.0f) outL = -32768.0f;
-        if (outR > 32767.0f) outR = 32767.0f;
-        if (outR < -32768.0f) outR = -32768.0f;
-
-        samples[i]   = (short)outL;
-        samples[i+1] = (short)outR;
+// the mix, through the output stage and into the device's format
+static void pcm_fill(void *out, const short *in, int frames) {
+    dsp_bass(bass_boost_enabled);
+    dsp_process(out, in, frames, pcm_format != SND_PCM_FORMAT_S16_LE);
+
+    if (!pcm_history) return;
+    const char *from = (const char *)out;
+    while (frames > 0) {
+        snd_pcm_uframes_t n = std::min((snd_pcm_uframes_t)frames, pcm_history_frames - pcm_history_at);
+        memcpy(pcm_history + pcm_history_at * pcm_frame_bytes, from, n * pcm_frame_bytes);
+        pcm_history_at = (pcm_history_at + n) % pcm_history_frames;
+        from += n * pcm_frame_bytes;
+        frames -= n;
     }
 }
+
+static void scope_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening %s\n", path);
+		return;
+	}
+
+	void *p = MAP_FAILED;
+	if (!ftruncate(fd, sizeof(scope_block)))
+		p = mmap(NULL, sizeof(scope_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Error mapping %s\n", path);
+		return;
+	}
+
+	scope = (scope_block *)p;
+	seqlock_write_begin(&scope->seq);
+	scope->magic = SCOPE_MAGIC;
+	memset(scope->wave, 0, sizeof(scope->wave));
+	seqlock_write_end(&scope->seq);
+	scope_enabled = 1;
+}
+
+// the first W samples of each channel from its trigger on, which is all a view shows
+static void scope_publish(int c)
+{
+	seqlock_write_begin(&scope->seq);
+	for (int ch = 0; ch < SCOPE_CHANNELS; ch++)
+		memcpy(scope->wave[ch], draw_buf[c][ch], sizeof(scope->wave[ch]));
+	seqlock_write_end(&scope->seq);
+}
+
+static void status_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening %s\n", path);
+		return;
+	}
+
+	void *p = MAP_FAILED;
+	if (!ftruncate(fd, sizeof(play_status)))
+		p = mmap(NULL, sizeof(play_status), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Error mapping %s\n", path);
+		return;
+	}
+
+	status = (play_status *)p;
+	seqlock_write_begin(&status->seq);
+	memset((char *)status + offsetof(play_status, state), 0, sizeof(*status) - offsetof(play_status, state));
+	status->magic = STATUS_MAGIC;
+	status->version = STATUS_VERSION;
+	seqlock_write_end(&status->seq);
+}
+
+// STATUS_LOADING once as each track starts, STATUS_PLAYING after every block and
+// STATUS_ENDED once it is drained
+static void status_update(unsigned int state)
+{
+	snd_pcm_sframes_t delay = 0;
+
+	if (!status) return;
+
+	if (state == STATUS_PLAYING) {
+		if (decode_pos_ms >= TrackLength - FadeLength && !IgnoreTrackLength && !playforever)
+			state = STATUS_FADING;
+		else if (DetectSilence && silencedetected > sndSamplesPerSec / 2)
+			state = STATUS_SILENT;
+	}
+
+	if (state != STATUS_ENDED && pcm_handle && snd_pcm_delay(pcm_handle, &delay) < 0)
+		delay = 0;
+	if (delay < 0 || (unsigned long long)delay > status_written)
+		delay = status_written;
+
+	seqlock_write_begin(&status->seq);
+	if (state == STATUS_LOADING)
+		status->track++;
+	status->state = state;
+	status->rate = sndSamplesPerSec;
+	status->length_ms = (IgnoreTrackLength || playforever) ? 0 : TrackLength;
+	status->fade_ms = FadeLength;
+	status->xruns = status_xruns;
+	status->speed = status_speed;
+	status->cpu = cpupercent;
+	status->bass = bass_boost_enabled;
+	status->position = status_written - delay;
+	seqlock_write_end(&status->seq);
+}
+
+// from when one block was handed to the device to when the next one is ready is what
+// emulating it took; how much faster than real time that is, smoothed over a few blocks
+static steady_clock::time_point status_handed;
+static bool status_timed = false;
+
+static void status_speed_measure(int frames)
+{
+	if (!status_timed) return;
+
+	double spent = duration<double>(steady_clock::now() - status_handed).count();
+	double played = (double)frames / sndSamplesPerSec;
+	if (spent > 0) {
+		unsigned int speed = (unsigned int)(played / spent * 100.0);
+		status_speed = status_speed ? (status_speed * 7 + speed) / 8 : speed;
+	}
+}
+
+// an xrun, or anything else the stream has to be prepared again after
+static void pcm_recover(void)
+{
+	status_xruns++;
+	snd_pcm_prepare(pcm_handle);
+}
+
 extern "C" void writeSound(void)
 {
-    int ret = soundBufferLen;
+    int ret = soundBufferIndex * sizeof(short);
+
+    // -a renders for loopfind alone, as fast as the emulation goes
+    if (analyse) {
+        loopfind_feed((const short *)soundFinalWave, ret / (2 * sndNumChannels));
+        decode_pos_ms += (ret / (2 * sndNumChannels)) * 1000.0 / sndSamplesPerSec;
+        return;
+    }
 
     int ratio = ioMem[0x82] & 3;
     int dsaRatio = ioMem[0x82] & 4;
@@ -204,52 +362,222 @@ extern "C" void writeSound(void)
             break;
     }
 
-    for (int i = 0; i < 4; i++)
-        updateBuf(curr_buf, i, m, soundBuffer[i], soundIndex);
-
-    if (!dsaRatio) m = 0.5; else m = 1;
-    m = m / float(soundLevel1) / 52.0;
-    updateBuf(curr_buf, 4, m, directBuffer[0], soundIndex);
+    if (scope_enabled) {
+        for (int i = 0; i < 4; i++)
+            updateBuf(curr_buf, i, m, soundBuffer[i], soundIndex);
 
-    if (!dsbRatio) m = 0.5; else m = 1;
-    m = m / float(soundLevel1) / 52.0;
-    updateBuf(curr_buf, 5, m, directBuffer[1], soundIndex);
+        if (!dsaRatio) m = 0.5; else m = 1;
+        m = m / float(soundLevel1) / 52.0;
+        updateBuf(curr_buf, 4, m, directBuffer[0], soundIndex);
 
-    bufmtx.lock();
-    curr_buf = !curr_buf;
-    bufmtx.unlock();
+        if (!dsbRatio) m = 0.5; else m = 1;
+        m = m / float(soundLevel1) / 52.0;
+        updateBuf(curr_buf, 5, m, directBuffer[1], soundIndex);
 
-    static short tempBuffer[1470];
-    memcpy(tempBuffer, soundFinalWave, ret);
+        curr_buf = !curr_buf;
+        scope_publish(curr_buf);
+    }
 
-    snd_pcm_sframes_t delay_frames = 0;
-    if (snd_pcm_delay(pcm_handle, &delay_frames) < 0)
-        delay_frames = 0;
+    int frames_to_deliver = ret / (2 * sndNumChannels);
+    if (status) status_speed_measure(frames_to_deliver);
+    const short *mix = (const short *)soundFinalWave;
+
+    if (!pcm_mmap) {
+        static int tempBuffer[1470];
+        const char *p = (const char *)tempBuffer;
+        int failed = 0;
+
+        // the rest of a short write goes after it, and after an xrun the block goes on
+        // from where it stopped; a device that can't be prepared again loses the block
+        pcm_fill(tempBuffer, mix, frames_to_deliver);
+        while (frames_to_deliver > 0) {
+            snd_pcm_sframes_t written = snd_pcm_writei(pcm_handle, p, frames_to_deliver);
+            if (written < 0) {
+                if (++failed > 2)
+                    break;
+                pcm_recover();
+                continue;
+            }
+            failed = 0;
+            p += written * pcm_frame_bytes;
+            frames_to_deliver -= written;
+        }
+    } else {
+        // the post-processing writes straight into the ring, as much as is free at a
+        // time. a stream that isn't running yet is started once the ring is full, and
+        // when it has no room the player sleeps until the profile's share of it is free
+        while (frames_to_deliver > 0) {
+            snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm_handle);
+            if (avail < 0) {
+                pcm_recover();
+                break;
+            }
+            if (avail == 0) {
+                if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED)
+                    snd_pcm_start(pcm_handle);
+                if (snd_pcm_wait(pcm_handle, 1000) < 0)
+                    pcm_recover();
+                continue;
+            }
+
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+            snd_pcm_uframes_t n = (avail < frames_to_deliver) ? avail : frames_to_deliver;
+            if (snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &n) < 0) {
+                pcm_recover();
+                break;
+            }
 
-    int time_to_end_ms = TrackLength - FadeLength;
-    if (time_to_end_ms < 0) time_to_end_ms = 0;
+            char *ring = (char *)areas[0].addr + areas[0].first / 8 + offset * areas[0].step / 8;
+            pcm_fill(ring, mix, n);
 
-    if (time_to_end_ms <= FadeLength) {
-        float factor = (float)time_to_end_ms / (float)FadeLength;
-        if (factor < 0.0f) factor = 0.0f;
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm_handle, offset, n);
+            if (committed < 0 || (snd_pcm_uframes_t)committed != n) {
+                pcm_recover();
+                break;
+            }
 
-        int samplesCount = ret / sizeof(short);
-        for (int i = 0; i < samplesCount; i++) {
-            tempBuffer[i] = (short)(tempBuffer[i] * factor);
+            mix += n * sndNumChannels;
+            frames_to_deliver -= n;
         }
     }
 
-    int frames_to_deliver = ret / (2 * sndNumChannels);
-	if (bass_boost_enabled) {
-        int samplesCount = ret / sizeof(short);
-        lowshelf_process(tempBuffer, samplesCount);
-    }  
-    int written = snd_pcm_writei(pcm_handle, tempBuffer, frames_to_deliver);
-    if (written < 0) {
-        snd_pcm_prepare(pcm_handle);
+    decode_pos_ms += (ret / (2 * sndNumChannels)) * 1000.0 / sndSamplesPerSec;
+
+    if (status) {
+        status_written += ret / (2 * sndNumChannels);
+        status_update(STATUS_PLAYING);
+        status_handed = steady_clock::now();
+        status_timed = true;
     }
+}
 
-    decode_pos_ms += (ret / (2 * sndNumChannels)) * 1000.0 / sndSamplesPerSec;
+// the device's own rate is asked for, the one nearest the GBA's 44100 Hz, so alsa-lib
+// doesn't resample on top of the player; the mix is resampled to it instead. above
+// 48 kHz the mix buffers would overflow, so such a device is left to alsa-lib's rate
+// plugin as before. the format is S16, or S32 if the device can't take that
+static int pcm_configure(snd_pcm_hw_params_t *hw_params, bool native)
+{
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_uframes_t buffer_size, period_size, wake;
+
+	snd_pcm_hw_params_any(pcm_handle, hw_params);
+	// mmap if the device can, so writeSound needs no buffer of its own
+	pcm_mmap = snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+	if (!pcm_mmap)
+		snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+
+	pcm_format = SND_PCM_FORMAT_S16_LE;
+	if (snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format) < 0) {
+		pcm_format = SND_PCM_FORMAT_S32_LE;
+		if (snd_pcm_hw_params_set_format(pcm_handle, hw_params, pcm_format) < 0)
+			return -EINVAL;
+	}
+	if (snd_pcm_hw_params_set_channels(pcm_handle, hw_params, sndNumChannels) < 0)
+		return -EINVAL;
+
+	pcm_rate = sndSamplesPerSec;
+	snd_pcm_hw_params_set_rate_resample(pcm_handle, hw_params, native ? 0 : 1);
+	if (native) {
+		if (snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &pcm_rate, 0) < 0 || pcm_rate > 48000)
+			return -EINVAL;
+	} else if (snd_pcm_hw_params_set_rate(pcm_handle, hw_params, pcm_rate, 0) < 0) {
+		return -EINVAL;
+	}
+
+	buffer_size = (snd_pcm_uframes_t)pcm_profiles[pcm_profile].buffer_ms * pcm_rate / 1000;
+	period_size = (snd_pcm_uframes_t)pcm_profiles[pcm_profile].period_ms * pcm_rate / 1000;
+	snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &buffer_size);
+	snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &period_size, NULL);
+
+	int err = snd_pcm_hw_params(pcm_handle, hw_params);
+	if (err < 0)
+		return err;
+	snd_pcm_hw_params_get_period_size(hw_params, &frames, NULL);
+	snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size);
+
+	pcm_can_pause = snd_pcm_hw_params_can_pause(hw_params);
+	pcm_frame_bytes = sndNumChannels * (pcm_format == SND_PCM_FORMAT_S16_LE ? 2 : 4);
+	free(pcm_history);
+	pcm_history = NULL;
+	if (!pcm_can_pause) {
+		pcm_history_frames = buffer_size;
+		pcm_history_at = 0;
+		pcm_history = (char *)calloc(buffer_size, pcm_frame_bytes);
+	}
+
+	// writei and snd_pcm_wait both sleep until this much is free, and playback starts
+	// with the buffer full, which writeSound's mmap path does by itself anyway
+	wake = pcm_profiles[pcm_profile].wake ? buffer_size * pcm_profiles[pcm_profile].wake / 100 : frames;
+	snd_pcm_sw_params_alloca(&sw_params);
+	snd_pcm_sw_params_current(pcm_handle, sw_params);
+	snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, wake);
+	snd_pcm_sw_params_set_start_threshold(pcm_handle, sw_params, buffer_size);
+	return snd_pcm_sw_params(pcm_handle, sw_params);
+}
+
+static void pcm_open(void)
+{
+	snd_pcm_hw_params_t *hw_params;
+	int err;
+
+	if ((err = snd_pcm_open(&pcm_handle, pcm_device,
+	                        SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+	    fprintf(stderr, "Error opening PCM device %s: %s\n", pcm_device, snd_strerror(err));
+	    exit(1);
+	}
+
+	snd_pcm_hw_params_alloca(&hw_params);
+	if (pcm_configure(hw_params, true) < 0 && (err = pcm_configure(hw_params, false)) < 0) {
+	    fprintf(stderr, "Error setting HW parameters: %s\n", snd_strerror(err));
+	    snd_pcm_close(pcm_handle);
+	    exit(1);
+	}
+}
+
+// pausing holds what the device has in it, and resuming plays on from the same sample.
+// one that can pause is paused; any other is stopped and given back, on resume, the
+// part of its buffer it hadn't played yet
+static int pcm_pause(void)
+{
+	snd_pcm_sframes_t delay = 0;
+
+	if (snd_pcm_state(pcm_handle) != SND_PCM_STATE_RUNNING)
+		return 0;
+	if (pcm_can_pause && snd_pcm_pause(pcm_handle, 1) == 0)
+		return 1;
+
+	if (!pcm_history || snd_pcm_delay(pcm_handle, &delay) < 0 || delay < 0)
+		delay = 0;
+	pcm_replay = std::min((snd_pcm_uframes_t)delay, pcm_history_frames);
+	snd_pcm_drop(pcm_handle);
+	snd_pcm_prepare(pcm_handle);
+	return 0;
+}
+
+static void pcm_resume(int paused)
+{
+	if (paused) {
+		if (snd_pcm_pause(pcm_handle, 0) < 0)
+			pcm_recover();
+		return;
+	}
+	// a device that can pause keeps no history, and one that wasn't running has nothing
+	if (!pcm_history || !pcm_replay)
+		return;
+
+	// the ring from pcm_replay frames back, in one or two pieces
+	snd_pcm_uframes_t from = (pcm_history_at + pcm_history_frames - pcm_replay) % pcm_history_frames;
+	while (pcm_replay > 0) {
+		snd_pcm_uframes_t n = std::min(pcm_replay, pcm_history_frames - from);
+		const char *p = pcm_history + from * pcm_frame_bytes;
+		snd_pcm_sframes_t r = pcm_mmap ? snd_pcm_mmap_writei(pcm_handle, p, n) : snd_pcm_writei(pcm_handle, p, n);
+		if (r <= 0)
+			break;
+		from = (from + r) % pcm_history_frames;
+		pcm_replay -= r;
+	}
+	pcm_replay = 0;
 }
 
 extern "C" void signal_handler(int sig)
@@ -277,6 +605,13 @@ extern "C" void signal_handler(int sig)
 	memcpy(&last_int, &tv_now, sizeof(struct timeval));
 }
 
+// the selector stops the player with SIGTERM, as does the system going down
+extern "C" void stop_handler(int sig)
+{
+	g_playing = 0;
+	g_must_exit = 1;
+}
+
 static void shuffle_list(char *filelist[], int num_files)
 {
 	int i, n;
@@ -299,16 +634,306 @@ extern "C" void handle_bass_toggle(int sig) {
 }
 
 
+// the control channel: with -c, the selector holds the other end of a pipe on stdin and
+// writes one command per line. it is read without blocking between emulation blocks,
+// so whatever it asks for lands on a block boundary
+
+static char control_line[256];
+static int control_len = 0;
+
+static void control_command(char *line)
+{
+	char *arg, *e;
+	int value;
+
+	arg = line + strcspn(line, " ");
+	if (*arg) *arg++ = 0;
+	value = strtol(arg, &e, 0);
+
+	if (!strcmp(line, "interp")) {
+		if (e==arg || value < 0 || value >= INTERP_MODES) {
+			fprintf(stderr, "Bad value\n");
+			return;
+		}
+		interp_switch(value);
+	}
+	else if (!strcmp(line, "window")) {
+		if (e==arg || value < 0 || value >= WFIR_TYPES) {
+			fprintf(stderr, "Bad value\n");
+			return;
+		}
+		interp_window(value);
+	}
+	else if (!strcmp(line, "pause")) {
+		if (e==arg) {
+			fprintf(stderr, "Bad value\n");
+			return;
+		}
+		g_paused = value != 0;
+	}
+	else if (!strcmp(line, "seek")) {
+		if (e==arg || value < 0) {
+			fprintf(stderr, "Bad value\n");
+			return;
+		}
+		seek_needed = value;
+	}
+	else if (!strcmp(line, "scope")) {
+		if (e==arg || !scope) {
+			fprintf(stderr, "Bad value\n");
+			return;
+		}
+		scope_enabled = value != 0;
+	}
+	else if (!strcmp(line, "keep")) {
+		// the state is written once the block is done, and then the player exits
+		g_keep = 1;
+		g_playing = 0;
+		g_must_exit = 1;
+	}
+	else if (*line) {
+		fprintf(stderr, "Unknown command: %s\n", line);
+	}
+}
+
+static void control_poll(void)
+{
+	ssize_t n;
+	char *nl;
+
+	while ((n = read(STDIN_FILENO, control_line + control_len,
+	                 sizeof(control_line) - 1 - control_len)) > 0) {
+		control_len += n;
+		control_line[control_len] = 0;
+
+		while ((nl = strchr(control_line, '\n')) != NULL) {
+			*nl = 0;
+			control_command(control_line);
+			control_len -= nl + 1 - control_line;
+			memmove(control_line, nl + 1, control_len + 1);
+		}
+
+		// a line that doesn't fit is nothing we know anyway
+		if (control_len == sizeof(control_line) - 1) control_len = 0;
+	}
+
+	// the selector went away, there is nobody left to listen to
+	if (n == 0) g_control = 0;
+}
+
+// output frames per tick of the mix: one at 44100 Hz, or as the native mix is resampled
+static double tick_frames(void)
+{
+	return soundNativeMix ? (double)SOUND_CLOCK_TICKS * sndSamplesPerSec / 16777216 : 1.0;
+}
+
+// where the emulation is, in output frames from the start of the track, counting the
+// ticks it ran that aren't mixed yet
+static long long mix_position(void)
+{
+	return llround(decode_pos_ms * sndSamplesPerSec / 1000 + soundIndex * tick_frames());
+}
+
+// with -R, the track is kept as it is when the selector stops the player with "keep",
+// so the next one can start from there even if the device is switched off meanwhile.
+// only then: a card written on every pause or skip wears for nothing
+static void resume_save(char *file)
+{
+	if (resume_path && !snapshot_save(resume_path, file, mix_position(), sndSamplesPerSec))
+		fprintf(stderr, "Can't keep the state in %s\n", resume_path);
+}
+
+// a pause parks the player in poll() on the control channel, where it uses no CPU
+// until the selector says otherwise, goes away, or the track is stopped
+static void pause_wait(void)
+{
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	int paused;
+
+	status_update(STATUS_PAUSED);
+	paused = pcm_pause();
+
+	while (g_paused && g_control && g_playing) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+		control_poll();
+	}
+	g_paused = 0;
+
+	pcm_resume(paused);
+}
+
+// every -K seconds of the track the machine is kept, in output frames from its start,
+// mixed or not; keyframes taken while seeking are as good as those taken playing
+static void keyframe_check(long long position)
+{
+	long long last = snapshot_last();
+
+	if (keyframe_interval > 0 &&
+	    (last < 0 || position >= last + (long long)keyframe_interval * sndSamplesPerSec))
+		snapshot_take(position);
+}
+
+// what the device still had to play is from before; the new position plays at once
+static void seek_done(long long to)
+{
+	snd_pcm_drop(pcm_handle);
+	snd_pcm_prepare(pcm_handle);
+
+	decode_pos_ms = to * 1000.0 / sndSamplesPerSec;
+	dsp_seek(to);
+	silencedetected = 0;
+	status_written = to;
+	status_timed = false;
+	status_update(STATUS_PLAYING);
+}
+
+// a seek runs the emulation with nothing rendered, mixed or written until the mix is
+// where it asked, which takes a fraction of a second for a minute of music. it starts
+// from the last keyframe before the point if that is closer, and there is no running
+// it backwards, so without one the track starts over
+static void seek(char *file, int ms)
+{
+	double per_tick = tick_frames();
+	long long at, to, key;
+	int ticks, pending = soundIndex;
+
+	if (!IgnoreTrackLength && !playforever && ms > TrackLength)
+		ms = TrackLength;
+
+	to = (long long)ms * sndSamplesPerSec / 1000;
+	at = llround(decode_pos_ms * sndSamplesPerSec / 1000);
+
+	key = snapshot_find(to);
+	if (key >= 0 && (to < at || key > at + pending * per_tick) && snapshot_restore(key) >= 0) {
+		at = key;
+		pending = 0;
+	} else if (to < at) {
+		if (!GSFRun(file)) {
+			g_playing = 0;
+			return;
+		}
+		sndSamplesPerSec = pcm_rate;
+		if (pcm_rate != 44100)
+			soundNativeMix = 1;
+		at = 0;
+		pending = 0;
+	}
+
+	// the ticks of the block not yet mixed are dropped, and count towards the seek
+	ticks = (int)((to - at) / per_tick) - pending;
+	soundSeek(ticks);
+	while (soundSeekTicks && g_playing) {
+		keyframe_check(at + llround((pending + ticks - soundSeekTicks) * per_tick));
+		EmulationLoop();
+	}
+
+	// stopped on the way there
+	if (soundSeekTicks) {
+		to = at + llround((pending + ticks - soundSeekTicks) * per_tick);
+		soundSeek(0);
+	}
+
+	seek_done(to);
+}
+
+// with -R and -S, the first track starts from what the player before kept of it, and
+// only runs up to -S if that is gone, or was kept of the file as it was before
+static bool resume_load(char *file)
+{
+	long long at;
+
+	// the first keyframe is the start of the track all the same
+	keyframe_check(0);
+
+	at = snapshot_load(resume_path, file, sndSamplesPerSec);
+	if (at < 0)
+		return false;
+
+	soundSeek(0);
+	seek_done(at);
+	return true;
+}
+
+static void format_length(char *out, size_t size, long long ms)
+{
+	snprintf(out, size, "%lld:%02lld.%03lld", ms / 60000, ms / 1000 % 60, ms % 1000);
+}
+
+// with -a, a track plays to no device until loopfind says where it loops or ends, or
+// ANALYSE_MAX seconds of it tell nothing. the length it comes to is the intro and the
+// loop twice, with the usual fade; -u writes that into the track if it has no length
+static void analyse_track(char *file, char *tag)
+{
+	loopfind_result lr;
+	long long frames, checked = 0;
+	int found = LOOPFIND_NONE;
+	char intro_str[32], loop_str[32], length_str[32], fade_str[32], tagged[32];
+
+	loopfind_start(sndSamplesPerSec);
+	playforever = 1;
+	DetectSilence = 0;
+	g_playing = 1;
+
+	while (g_playing && found == LOOPFIND_NONE) {
+		EmulationLoop();
+		frames = llround(decode_pos_ms * sndSamplesPerSec / 1000);
+		if (frames - checked >= (long long)ANALYSE_EVERY * sndSamplesPerSec) {
+			checked = frames;
+			found = loopfind_find(&lr);
+			if (frames >= (long long)ANALYSE_MAX * sndSamplesPerSec)
+				break;
+		}
+	}
+
+	if (found == LOOPFIND_NONE) {
+		if (g_playing)
+			printf("%s: no loop in the first %d:%02d\n", file, ANALYSE_MAX / 60, ANALYSE_MAX % 60);
+		return;
+	}
+
+	format_length(intro_str, sizeof(intro_str), lr.intro * 1000 / sndSamplesPerSec);
+	if (found == LOOPFIND_LOOPS) {
+		format_length(loop_str, sizeof(loop_str), lr.loop * 1000 / sndSamplesPerSec);
+		format_length(length_str, sizeof(length_str), (lr.intro + 2 * lr.loop) * 1000 / sndSamplesPerSec);
+		snprintf(fade_str, sizeof(fade_str), "%d", deffade);
+		printf("%s: intro %s, loop %s; length %s, fade %s\n", file, intro_str, loop_str, length_str, fade_str);
+	} else {
+		strcpy(length_str, intro_str);
+		strcpy(fade_str, "0");
+		printf("%s: ends at %s; length %s, fade %s\n", file, intro_str, length_str, fade_str);
+	}
+
+	if (analyse < 2)
+		return;
+
+	if (archive_split(file, NULL, NULL)) {
+		fprintf(stderr, "%s: can't write the tags of a file in an archive\n", file);
+		return;
+	}
+	if (archive_readtag(tag, file))
+		tag[0] = 0;
+	if (!psftag_raw_getvar(tag, "length", tagged, sizeof(tagged))) {
+		printf("%s: has a length of %s already, left as it is\n", file, tagged);
+		return;
+	}
+	psftag_raw_setvar(tag, 50001, "length", length_str);
+	psftag_raw_setvar(tag, 50001, "fade", fade_str);
+	if (psftag_writetofile(tag, file))
+		fprintf(stderr, "%s: can't write the tags\n", file);
+}
+
 #define BOLD() printf("%c[36m", 27);
 #define NORMAL() printf("%c[0m", 27);
 
 int main(int argc, char **argv)
 {
-	int r, tmp, fi, random=0;
+	int r, tmp, fi, random=0, window=WFIR_TYPE, bands=0, resume=0;
 	char Buffer[1024];
 	char length_str[256], fade_str[256], volume[256], title_str[256];
 	char tmp_str[256];
 	char *tag;
+	static psftag_table tags;	// tag, read once per track
 
 	soundLowPass = 0;
 	soundEcho = 0;
@@ -323,7 +948,7 @@ int main(int argc, char **argv)
 	OutputFile = "";
 	noinfo=0;
 
-	while((r=getopt(argc, argv, "hlsrbieqW:L:t:"))>=0)
+	while((r=getopt(argc, argv, "hlsrbieqNFZcauI:W:L:t:w:M:D:P:O:T:E:S:K:R:"))>=0)
 	{
 		char *e;
 		switch(r)
@@ -333,13 +958,39 @@ int main(int argc, char **argv)
 						VERSION_STR, HA_VERSION_STR);
 				printf("Usage: ./playgsf [options] files...\n\n");
 				printf("  -l        Enable low pass filer\n");
+				printf("  -E        Add an EQ band, freq:gain[:q] in Hz and dB, e.g. 3000:-4:0.7.\n");
+				printf("            Up to %d, each its own -E\n", DSP_EQ_BANDS);
 				printf("  -s        Detect silence\n");
 				printf("  -L        Set silence length in seconds (for detection). Default 5\n");
 				printf("  -t        Set default track length in milliseconds. Default 150000 ms\n");
 				printf("  -i        Ignore track length (use default length)\n");
 				printf("  -e        Endless play\n");
+				printf("  -S        Start the first track this many milliseconds in\n");
+				printf("  -K        Keep the emulator state every this many seconds, so seeking\n");
+				printf("            back doesn't start the track over. Default 10, 0 for none\n");
+				printf("  -R        Keep the emulator state in this file when told to with \"keep\";\n");
+				printf("            with -S, start the first track from it if it was kept of it\n");
 				printf("  -r        Play files in random order\n");
+				printf("  -a        Play nothing; find where each track loops or ends, and the\n");
+				printf("            length and fade it should have\n");
+				printf("  -u        Same, and write them into the tracks that have no length\n");
 				printf("  -W        output to the specified filename rather than soundcard\n");
+				printf("  -P        Set the latency: 0 low latency, 1 normal (default), 2 power saving,\n");
+				printf("            which buffers half a second and sleeps for most of it\n");
+				printf("  -D        ALSA device to play on, e.g. hw:0 or plughw:0. Default \"default\"\n");
+				printf("  -N        Mix at the native GBA rate and resample the final mix once\n");
+				printf("  -F        Resample in fixed point instead of with libresample\n");
+				printf("  -I        Set the interpolation: 0 none, 1 linear, 2 cubic, 3 FIR8,\n");
+				printf("            4 libresample (default), 5 FIR16, 6 FIR32, 7 same as -F\n");
+				printf("  -w        Set the window of the FIR modes: 0 Hann, 1 Hamming, 2 Blackman,\n");
+				printf("            3-6 other Blackman variants, 7 Kaiser (default), 8 Lanczos\n");
+				printf("  -Z        Inflate large gsflibs a page at a time, as they are read\n");
+				printf("  -M        Keep inflated gsflibs for other players in this directory.\n");
+				printf("            Default /dev/shm, \"\" to not keep them\n");
+				printf("  -O        Capture the six sound channels for an oscilloscope into this file\n");
+				printf("  -T        Keep the playback position and state in this file\n");
+				printf("  -c        Take commands from stdin, one per line: interp <n>, window <n>,\n");
+				printf("            pause <0|1>, seek <ms>, scope <0|1> (with -O)\n");
 				printf("  -q        Quiet; don't display informational output\n");
 				printf("  -h        Displays what you are reading right now\n");
 				return 0;
@@ -363,9 +1014,32 @@ int main(int argc, char **argv)
 					return 1;
 				}
 				break;
+			case 'a':
+				if (!analyse) analyse = 1;
+				break;
+			case 'u':
+				analyse = 2;
+				break;
 			case 'e':
 				playforever = 1;
 				break;
+			case 'S':
+				start_ms = strtol(optarg, &e, 0);
+				if (e==optarg || start_ms < 0) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
+			case 'K':
+				keyframe_interval = strtol(optarg, &e, 0);
+				if (e==optarg || keyframe_interval < 0) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
+			case 'R':
+				resume_path = optarg;
+				break;
 			case 't':
 				DefaultLength = strtol(optarg, &e, 0);
 				if (e==optarg) {
@@ -383,6 +1057,60 @@ int main(int argc, char **argv)
 			case 'q':
 				noinfo = 1;
 				break;
+			case 'N':
+				soundNativeMix = 1;
+				break;
+			case 'F':
+				soundInterpolation = 7;
+				break;
+			case 'I':
+				soundInterpolation = strtol(optarg, &e, 0);
+				if (e==optarg || soundInterpolation < 0 || soundInterpolation >= INTERP_MODES) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
+			case 'c':
+				g_control = 1;
+				break;
+			case 'Z':
+				lazyromEnabled = 1;
+				break;
+			case 'P':
+				pcm_profile = strtol(optarg, &e, 0);
+				if (e==optarg || pcm_profile < 0 || pcm_profile >= PCM_PROFILES) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
+			case 'D':
+				pcm_device = optarg;
+				break;
+			case 'E': {
+				double freq, gain, q = 0.707;
+				if (sscanf(optarg, "%lf:%lf:%lf", &freq, &gain, &q) < 2 || freq <= 0 ||
+				    dsp_eq(bands++, freq, gain, q) < 0) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
+			}
+			case 'M':
+				shmromDir = optarg;
+				break;
+			case 'O':
+				scope_open(optarg);
+				break;
+			case 'T':
+				status_open(optarg);
+				break;
+			case 'w':
+				window = strtol(optarg, &e, 0);
+				if (e==optarg || window < 0 || window >= WFIR_TYPES) {
+					fprintf(stderr, "Bad value\n");
+					return 1;
+				}
+				break;
 			case '?':
 				fprintf(stderr, "Unknown argument. try -h\n");
 				return 1;
@@ -404,6 +1132,14 @@ int main(int argc, char **argv)
 	}
 
 	signal(SIGINT, signal_handler);
+	signal(SIGTERM, stop_handler);
+
+	if (g_control) {
+		fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+	}
+
+	interp_window(window);
+	interp_setup(soundInterpolation);
 
 	tag = (char*)malloc(50001);
 
@@ -412,18 +1148,43 @@ int main(int argc, char **argv)
 	while (!g_must_exit && fi < argc)
 	{
 		decode_pos_ms = 0;
-		seek_needed = -1;
+		seek_needed = start_ms;
+		resume = start_ms >= 0 && resume_path;
+		start_ms = -1;
 		TrailingSilence=1000;
+		status_written = 0;
+		status_timed = false;
+		status_update(STATUS_LOADING);
 
 		r = GSFRun(argv[fi]);
 		if (!r) {
 			fi++;
 			continue;
 		}
+		snapshot_clear();
+
+		if (analyse) {
+			analyse_track(argv[fi], tag);
+			fi++;
+			continue;
+		}
+
+		/* Must be done after GSFrun so sndNumchannels and
+		 * sndSamplesPerSec are set to valid values. the device stays
+		 * open from track to track, since a hw: one can't be opened twice */
+		if (!pcm_handle) {
+			pcm_open();
+			if (!noinfo && pcm_rate != (unsigned int)sndSamplesPerSec)
+				printf("Device runs at %u Hz, resampling the mix to it\n", pcm_rate);
+		}
+		sndSamplesPerSec = pcm_rate;
+		if (pcm_rate != 44100)
+			soundNativeMix = 1;
 
 		g_playing = 1;
 
-		psftag_readfromfile((void*)tag, argv[fi]);
+		archive_readtag((void*)tag, argv[fi]);
+		psftag_parse(&tags, tag);
 
 		if (!noinfo) {
 			BOLD(); printf("Filename: "); NORMAL();
@@ -433,47 +1194,47 @@ int main(int argc, char **argv)
 			BOLD(); printf("Sample rate: "); NORMAL();
 			printf("%d\n", sndSamplesPerSec);
 
-			if (!psftag_getvar(tag, "title", title_str, sizeof(title_str)-1)) {
+			if (!psftag_table_getvar(&tags, "title", title_str, sizeof(title_str)-1)) {
 				BOLD(); printf("Title: "); NORMAL();
 				printf("%s\n", title_str);
 			}
 
-			if (!psftag_getvar(tag, "artist", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "artist", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Artist: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "game", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "game", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Game: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "year", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "year", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Year: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "copyright", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "copyright", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Copyright: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "gsfby", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "gsfby", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("GSF By: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "tagger", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "tagger", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Tagger: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "comment", tmp_str, sizeof(tmp_str)-1)) {
+			if (!psftag_table_getvar(&tags, "comment", tmp_str, sizeof(tmp_str)-1)) {
 				BOLD(); printf("Comment: "); NORMAL();
 				printf("%s\n", tmp_str);
 			}
 
-			if (!psftag_getvar(tag, "fade", fade_str, sizeof(fade_str)-1)) {
+			if (!psftag_table_getvar(&tags, "fade", fade_str, sizeof(fade_str)-1)) {
 				FadeLength = LengthFromString(fade_str);
 				BOLD(); printf("Fade: "); NORMAL();
 				printf("%s (%d ms)\n", fade_str, FadeLength);
@@ -484,7 +1245,7 @@ int main(int argc, char **argv)
 			    printf("%s (%d ms)\n", fade_str, FadeLength);
 			}
 
-			if (!psftag_raw_getvar(tag, "length", length_str, sizeof(length_str)-1)) {
+			if (!psftag_table_getvar(&tags, "length", length_str, sizeof(length_str)-1)) {
 				TrackLength = LengthFromString(length_str) + FadeLength;
 				BOLD(); printf("Length: "); NORMAL();
 				printf("%s (%d ms) ", length_str, TrackLength);
@@ -498,7 +1259,7 @@ int main(int argc, char **argv)
 				TrackLength = DefaultLength;
 			}
 		} else {
-			if (!psftag_getvar(tag, "fade", fade_str, sizeof(fade_str)-1)) {
+			if (!psftag_table_getvar(&tags, "fade", fade_str, sizeof(fade_str)-1)) {
 				FadeLength = LengthFromString(fade_str);
 			} else {
 			    strcpy(fade_str, "10");
@@ -507,46 +1268,23 @@ int main(int argc, char **argv)
 			    printf("%s (%d ms)\n", fade_str, FadeLength);
 			}
 			
-			if (!psftag_raw_getvar(tag, "length", length_str, sizeof(length_str)-1)) {
+			if (!psftag_table_getvar(&tags, "length", length_str, sizeof(length_str)-1)) {
 				TrackLength = LengthFromString(length_str) + FadeLength;
 			} else {
 				TrackLength = DefaultLength;
 			}
 		}
 
-		/* Must be done after GSFrun so sndNumchannels and
-		 * sndSamplesPerSec are set to valid values */
-		int err;
-		if ((err = snd_pcm_open(&pcm_handle, "default",
-		                        SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-		    fprintf(stderr, "Error opening PCM device: %s\n", snd_strerror(err));
-		    exit(1);
-		}
-		
-		snd_pcm_hw_params_alloca(&hw_params);
-		snd_pcm_hw_params_any(pcm_handle, hw_params);
-		snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-		snd_pcm_hw_params_set_format(pcm_handle, hw_params, SND_PCM_FORMAT_S16_LE);
-		snd_pcm_hw_params_set_channels(pcm_handle, hw_params, sndNumChannels);
-		snd_pcm_hw_params_set_rate(pcm_handle, hw_params, sndSamplesPerSec, 0);
-		
-		unsigned int rate = sndSamplesPerSec;
-		snd_pcm_uframes_t buffer_size = 4096;
-		snd_pcm_uframes_t period_size = 1024;
-		
-		lowshelf_init((float)sndSamplesPerSec, 250.0f, 5.0f);
+		// the fade is the output stage's, so it lands on the sample
+		dsp_setup(sndSamplesPerSec);
+		dsp_reset();
+		dsp_volume(relvolume);
+		if (IgnoreTrackLength || playforever)
+			dsp_fade(0, 0);
+		else
+			dsp_fade((long long)(TrackLength - FadeLength) * sndSamplesPerSec / 1000,
+			         (long long)TrackLength * sndSamplesPerSec / 1000);
 		signal(SIGUSR2, handle_bass_toggle);
-		
-		snd_pcm_hw_params_set_buffer_size_near(pcm_handle, hw_params, &buffer_size);
-		snd_pcm_hw_params_set_period_size_near(pcm_handle, hw_params, &period_size, NULL);
-		
-		if ((err = snd_pcm_hw_params(pcm_handle, hw_params)) < 0) {
-		    fprintf(stderr, "Error setting HW parameters: %s\n", snd_strerror(err));
-		    snd_pcm_close(pcm_handle);
-		    exit(1);
-		}
-		
-		snd_pcm_hw_params_get_period_size(hw_params, &frames, NULL);
 
 		while(g_playing)
 		{
@@ -555,6 +1293,19 @@ int main(int argc, char **argv)
 				// this happens during silence period
 				remaining = 0;
 			}
+			if (g_control) control_poll();
+			if (g_paused) {
+				pause_wait();
+				continue;
+			}
+			if (seek_needed >= 0) {
+				if (!resume || !resume_load(argv[fi]))
+					seek(argv[fi], seek_needed);
+				seek_needed = -1;
+				resume = 0;
+				continue;
+			}
+			keyframe_check(mix_position());
 			EmulationLoop();
 
 			if (!noinfo) {
@@ -582,7 +1333,15 @@ int main(int argc, char **argv)
 		if (!noinfo) {
 			printf("\n--\n");
 		}
-        snd_pcm_drain(pcm_handle);
+        if (g_must_exit) {
+            if (g_keep)
+                resume_save(argv[fi]);
+            snd_pcm_drop(pcm_handle);
+        } else {
+            snd_pcm_drain(pcm_handle);
+        }
+        snd_pcm_prepare(pcm_handle);
+        status_update(STATUS_ENDED);
 		fi++;
 	}
 	
@@ -590,6 +1349,8 @@ int main(int argc, char **argv)
         free(tag);
         tag = NULL;
     }
+
+	interp_cleanup();
 	
 	if (pcm_handle) {
         snd_pcm_drop(pcm_handle);
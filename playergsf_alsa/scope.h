@@ -0,0 +1,21 @@
+#ifndef __SCOPE_H__
+#define __SCOPE_H__
+
+#include "seqlock.h"
+
+// with -O, the player leaves what each of the six sound channels last played, the four
+// PSG ones and then direct sound A and B, lined up on a falling edge, in a file a front
+// end maps and draws from. nothing is captured without it
+
+#define SCOPE_MAGIC			0x31435347	// "GSC1"
+#define SCOPE_CHANNELS		6
+#define SCOPE_WIDTH			800
+
+struct scope_block
+{
+	unsigned int magic;
+	unsigned int seq;			// see seqlock.h
+	int wave[SCOPE_CHANNELS][SCOPE_WIDTH];
+};
+
+#endif
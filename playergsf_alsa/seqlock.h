@@ -0,0 +1,38 @@
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+// what the player publishes for the selector in shared files is guarded by a sequence
+// count instead of a lock, so the player never waits for a reader: it is odd while the
+// player writes and even once it is done, and a copy taken while it stayed the same and
+// even is whole
+
+static inline void seqlock_write_begin(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// copies size bytes from block, which seq is part of, to out; 0 if the copy is whole,
+// -1 if the player kept writing over it
+static inline int seqlock_read(const void *block, const unsigned int *seq, void *out, unsigned long size)
+{
+	unsigned int s;
+	int tries;
+
+	for (tries = 0; tries < 4; tries++)
+	{
+		s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (s & 1) continue;
+		__builtin_memcpy(out, block, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq, __ATOMIC_RELAXED) == s) return 0;
+	}
+	return -1;
+}
+
+#endif
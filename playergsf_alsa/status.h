@@ -0,0 +1,37 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#include "seqlock.h"
+
+// with -T, the player keeps where it is in a file a front end maps, rewritten after
+// every block of sound it hands to the device. the position is what has been heard,
+// what was written less what the device still holds, so it is exact to the sample
+
+#define STATUS_MAGIC		0x31545350	// "PST1"
+#define STATUS_VERSION		1			// bumped when fields change; new ones go at the end
+
+#define STATUS_LOADING		0			// between tracks
+#define STATUS_PLAYING		1
+#define STATUS_SILENT		2			// silence detection is counting
+#define STATUS_FADING		3
+#define STATUS_ENDED		4			// played out and drained
+#define STATUS_PAUSED		5
+
+struct play_status
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int seq;			// see seqlock.h
+	unsigned int state;
+	unsigned int track;			// counts the tracks started, from 1
+	unsigned int rate;			// of position, in Hz
+	unsigned int length_ms;		// the fade included; 0 when played without end
+	unsigned int fade_ms;
+	unsigned int xruns;
+	unsigned int speed;			// emulation speed, in percent of real time
+	unsigned int cpu;			// how busy the GBA's CPU is, in percent
+	unsigned int bass;
+	unsigned long long position;	// in samples from the start of the track
+};
+
+#endif
@@ -6,6 +6,8 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -13,11 +15,15 @@
 #include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <fstream>
 
 extern "C" {
 #include "VBA/psftag.h"
 }
+#include "playergsf_alsa/VBA/archive.h"
+#include "playergsf_alsa/scope.h"
+#include "playergsf_alsa/status.h"
 
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
@@ -49,9 +55,28 @@ const int scroll_delay = 4000;
 bool bass_enabled_local = false;
 
 pid_t playgsf_pid = -1;
+int playgsf_ctl = -1; // write end of the player's control channel (its stdin)
 bool paused = false;
 bool screen_off = false;
 
+// the player's oscilloscope, see scope.h. the file is the selector's, handed to every
+// player it starts; the player only captures into it while the view is up
+std::string scope_path;
+const scope_block* scope_map = nullptr;
+scope_block scope_frame;
+bool scope_view = false;
+
+// and where it is, see status.h. the selector clears the magic before it starts a
+// player, so until that one has written to it nothing stale is read
+std::string status_path;
+play_status* status_map = nullptr;
+play_status status_now;
+
+// set when a player exits, so it is only waited for then
+static volatile sig_atomic_t child_exited = 0;
+// set when the selector is told to stop, as when the system goes down
+static volatile sig_atomic_t quit_requested = 0;
+
 SDL_Window* window = nullptr;
 SDL_Renderer* renderer = nullptr;
 TTF_Font* font = nullptr;
@@ -79,12 +104,27 @@ static int battery = 0; // battery percentage from /sys/class/power_supply/batte
 static Uint32 last_battery_update = 0;
 static const Uint32 battery_update_interval = 1000; // 1 second in ms
 
+// interpolation of the player: linear on battery, libresample when plugged in
+static bool on_ac = false;
+static const int interp_battery = 1;
+static const int interp_ac = 4;
+// and its latency: the power saving profile on battery, fixed when the track starts
+static const int profile_battery = 2;
+static const int profile_ac = 1;
+
 std::string state_file_path() {
     std::string dir = "/storage/.config/playgsf";
     mkdir(dir.c_str(), 0755);
     return dir + "/state.txt";
 }
 
+// where the player keeps the track it was stopped in, see -R
+std::string resume_file_path() {
+    std::string dir = "/storage/.config/playgsf";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/resume.state";
+}
+
 int read_battery_percent() {
     FILE* f = fopen("/sys/class/power_supply/battery/capacity", "r");
     if (!f) return -1;
@@ -101,11 +141,34 @@ int read_battery_percent() {
     return percent;
 }
 
+bool read_on_ac() {
+    FILE* f = fopen("/sys/class/power_supply/battery/status", "r");
+    if (!f) return false;
+
+    char status[32] = "";
+    if (fscanf(f, "%31s", status) != 1) {
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    return strcmp(status, "Charging") == 0 || strcmp(status, "Full") == 0;
+}
+
 bool is_directory(const std::string& path) {
     struct stat st{};
     return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
 }
 
+// a .zip holding a whole set is browsed like a folder, see archive.h
+bool is_archive(const std::string& path) {
+    struct stat st{};
+    if (path.size() < 4) return false;
+    std::string ext = path.substr(path.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".zip" && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
 bool is_valid_music(const std::string& fname) {
     auto pos = fname.find_last_of('.');
     if (pos == std::string::npos) return false;
@@ -114,21 +177,30 @@ bool is_valid_music(const std::string& fname) {
     return (ext == ".minigsf" || ext == ".gsf");
 }
 
+static int list_archive_member(const char* name, unsigned int, void*) {
+    if (is_valid_music(name)) entries.emplace_back(Entry{name, false});
+    return 0;
+}
+
 void list_directory(const std::string& path, bool reset_selection = true) {
     entries.clear();
-    DIR* dir = opendir(path.c_str());
-    if (!dir) return;
-    struct dirent* entry = nullptr;
-    while ((entry = readdir(dir)) != nullptr) {
-        std::string name = entry->d_name;
-        if (name == "." || name == "..") continue;
-        std::string full_path = path + "/" + name;
-        bool dir_flag = is_directory(full_path);
-        if (dir_flag || is_valid_music(name)) {
-            entries.emplace_back(Entry{name, dir_flag});
+    if (is_archive(path)) {
+        archive_list(path.c_str(), list_archive_member, nullptr);
+    } else {
+        DIR* dir = opendir(path.c_str());
+        if (!dir) return;
+        struct dirent* entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            std::string full_path = path + "/" + name;
+            bool dir_flag = is_directory(full_path) || is_archive(full_path);
+            if (dir_flag || is_valid_music(name)) {
+                entries.emplace_back(Entry{name, dir_flag});
+            }
         }
+        closedir(dir);
     }
-    closedir(dir);
     std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){
         if (a.is_dir != b.is_dir) return a.is_dir > b.is_dir;
         return a.name < b.name;
@@ -147,25 +219,129 @@ void kill_playgsf() {
     }
 }
 
-bool launch_playgsf(const std::string& filepath) {
+// one command per line, see control_command in the player
+void send_playgsf(const char* cmd) {
+    if (playgsf_ctl < 0) return;
+    std::string line = std::string(cmd) + "\n";
+    if (write(playgsf_ctl, line.c_str(), line.size()) < 0) {
+        close(playgsf_ctl);
+        playgsf_ctl = -1;
+    }
+}
+
+void close_playgsf_ctl() {
+    if (playgsf_ctl >= 0) {
+        close(playgsf_ctl);
+        playgsf_ctl = -1;
+    }
+}
+
+// from start_ms in, if given, where the player picks up the state it kept of the track
+// or else runs up to
+bool launch_playgsf(const std::string& filepath, int start_ms = -1) {
     if (playgsf_pid != -1) return false;
+    int ctl[2];
+    if (pipe(ctl) < 0) return false;
+    std::string interp = std::to_string(on_ac ? interp_ac : interp_battery);
+    std::string profile = std::to_string(on_ac ? profile_ac : profile_battery);
+    std::string resume = resume_file_path();
+    std::string start = std::to_string(start_ms);
+    std::vector<const char*> args = {"playgsf", "-s", "-q", "-c", "-I", interp.c_str(), "-P", profile.c_str(),
+                                     "-R", resume.c_str()};
+    if (start_ms >= 0) {
+        args.push_back("-S");
+        args.push_back(start.c_str());
+    }
+    if (bass_enabled_local) args.push_back("-b");
+    if (scope_map) {
+        args.push_back("-O");
+        args.push_back(scope_path.c_str());
+    }
+    if (status_map) {
+        args.push_back("-T");
+        args.push_back(status_path.c_str());
+        __atomic_store_n(&status_map->magic, 0, __ATOMIC_RELEASE);
+        status_now.magic = 0;
+    }
+    args.push_back(filepath.c_str());
+    args.push_back(nullptr);
     pid_t pid = fork();
     if (pid == 0) {
-        
-        if (bass_enabled_local)
-            execl("/usr/bin/playgsf", "playgsf", "-s", "-q", "-b", filepath.c_str(), nullptr);
-        else
-            execl("/usr/bin/playgsf", "playgsf", "-s", "-q", filepath.c_str(), nullptr);
+        dup2(ctl[0], STDIN_FILENO);
+        close(ctl[0]);
+        close(ctl[1]);
+
+        execv("/usr/bin/playgsf", (char* const*)args.data());
 
         _exit(127);
     } else if (pid > 0) {
+        close(ctl[0]);
+        fcntl(ctl[1], F_SETFD, FD_CLOEXEC);
+        playgsf_ctl = ctl[1];
         playgsf_pid = pid;
         paused = false;
+        if (scope_map && !scope_view) send_playgsf("scope 0");
         return true;
     }
+    close(ctl[0]);
+    close(ctl[1]);
     return false;
 }
 
+// the files shared with the player live on a tmpfs, named after the selector
+void* shared_open(std::string& path, const char* name, size_t size) {
+    void* p = MAP_FAILED;
+    path = std::string("/dev/shm/playgsf-") + name + "-" + std::to_string(getpid());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return nullptr;
+    if (ftruncate(fd, size) == 0)
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p != MAP_FAILED) return p;
+    unlink(path.c_str());
+    return nullptr;
+}
+
+void shared_close(const void* p, const std::string& path, size_t size) {
+    if (!p) return;
+    munmap((void*)p, size);
+    unlink(path.c_str());
+}
+
+// what the player last published, if this player published anything yet
+bool read_status() {
+    if (!status_map || seqlock_read(status_map, &status_map->seq, &status_now, sizeof(status_now)))
+        return false;
+    return status_now.magic == STATUS_MAGIC && status_now.version >= STATUS_VERSION && status_now.rate > 0;
+}
+
+int status_elapsed_ms() {
+    return (int)(status_now.position * 1000 / status_now.rate);
+}
+
+static void on_child_exit(int) {
+    child_exited = 1;
+}
+
+static void on_quit(int) {
+    quit_requested = 1;
+}
+
+void scope_toggle() {
+    if (!scope_map) return;
+    scope_view = !scope_view;
+    send_playgsf(scope_view ? "scope 1" : "scope 0");
+}
+
+// from where the player says it is; it fast-forwards there, or for an earlier point
+// starts the track over and does
+void seek_by(int delta_ms) {
+    if (playgsf_pid <= 0 || !read_status()) return;
+    int to = status_elapsed_ms() + delta_ms;
+    if (to < 0) to = 0;
+    send_playgsf(("seek " + std::to_string(to)).c_str());
+}
+
 int find_next_track(int current, bool forward = true) {
     int idx = current;
     int size = (int)entries.size();
@@ -200,25 +376,28 @@ int parse_length(const std::string& str) {
 
 bool read_metadata(const std::string& file, TrackMetadata& out) {
     out = TrackMetadata{};
-    char tag[50001] = {0};
-    if (psftag_readfromfile((void*)tag, file.c_str())) return false;
+    static char tag[50001];
+    static psftag_table tags;
+    memset(tag, 0, sizeof(tag));
+    if (archive_readtag((void*)tag, file.c_str())) return false;
+    psftag_parse(&tags, tag);
 
     char buf[512] = {0};
     out.filename = file;
-    if (psftag_getvar(tag, "title", buf, sizeof(buf)) == 0) out.title = buf;
-    if (psftag_getvar(tag, "artist", buf, sizeof(buf)) == 0) out.artist = buf;
-    if (psftag_getvar(tag, "game", buf, sizeof(buf)) == 0) out.game = buf;
-    if (psftag_getvar(tag, "year", buf, sizeof(buf)) == 0) out.year = buf;
-    if (psftag_getvar(tag, "copyright", buf, sizeof(buf)) == 0) out.copyright = buf;
-    if (psftag_getvar(tag, "gsfby", buf, sizeof(buf)) == 0) out.gsf_by = buf;
-
-	if (psftag_getvar(tag, "length", buf, sizeof(buf)) == 0) {
+    if (psftag_table_getvar(&tags, "title", buf, sizeof(buf)) == 0) out.title = buf;
+    if (psftag_table_getvar(&tags, "artist", buf, sizeof(buf)) == 0) out.artist = buf;
+    if (psftag_table_getvar(&tags, "game", buf, sizeof(buf)) == 0) out.game = buf;
+    if (psftag_table_getvar(&tags, "year", buf, sizeof(buf)) == 0) out.year = buf;
+    if (psftag_table_getvar(&tags, "copyright", buf, sizeof(buf)) == 0) out.copyright = buf;
+    if (psftag_table_getvar(&tags, "gsfby", buf, sizeof(buf)) == 0) out.gsf_by = buf;
+
+	if (psftag_table_getvar(&tags, "length", buf, sizeof(buf)) == 0) {
         out.length = buf;
     } else {
         out.length = "150";
     }
 
-    if (psftag_getvar(tag, "fade", buf, sizeof(buf)) == 0) {
+    if (psftag_table_getvar(&tags, "fade", buf, sizeof(buf)) == 0) {
         out.fade = buf;
     } else {
         out.fade = "10";
@@ -371,6 +550,39 @@ void draw_list() {
     SDL_RenderPresent(renderer);
 }
 
+// the six channels in two columns, each scaled to its own peak
+void draw_scope(int x, int y, int w, int h) {
+    static const char* names[SCOPE_CHANNELS] = {"SQ1", "SQ2", "WAV", "NOI", "DSA", "DSB"};
+    SDL_Color label = {0, 255, 0, 255};
+    SDL_Point points[SCOPE_WIDTH];
+
+    if (seqlock_read(scope_map, &scope_map->seq, &scope_frame, sizeof(scope_frame)) == 0 &&
+        scope_frame.magic != SCOPE_MAGIC)
+        memset(scope_frame.wave, 0, sizeof(scope_frame.wave));
+
+    int pw = w / 2, ph = h / 3;
+    for (int ch = 0; ch < SCOPE_CHANNELS; ch++) {
+        int px = x + (ch % 2) * pw, py = y + (ch / 2) * ph;
+        const int* wave = scope_frame.wave[ch];
+        int peak = 1;
+        for (int i = 0; i < SCOPE_WIDTH; i++)
+            peak = std::max(peak, std::abs(wave[i]));
+
+        int n = std::min(pw - 4, SCOPE_WIDTH);
+        for (int i = 0; i < n; i++) {
+            points[i].x = px + 2 + i;
+            points[i].y = py + ph / 2 - wave[i * SCOPE_WIDTH / n] * (ph / 2 - 2) / peak;
+        }
+
+        SDL_Rect frame = {px, py, pw - 2, ph - 2};
+        SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+        SDL_RenderDrawRect(renderer, &frame);
+        SDL_SetRenderDrawColor(renderer, 255, 165, 0, 255);
+        SDL_RenderDrawLines(renderer, points, n);
+        render_text(names[ch], px + 4, py + 2, label);
+    }
+}
+
 void draw_playback(const TrackMetadata& meta, int elapsed) {
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
@@ -399,6 +611,14 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
         } else {
             total_seconds = length_sec + fade_sec;
         }
+
+    // what the player itself goes by, once it says
+    bool live = playgsf_pid > 0 && status_now.magic == STATUS_MAGIC && status_now.rate > 0 && status_now.length_ms > 0;
+    int total_ms = total_seconds * 1000;
+    if (live) {
+        total_ms = status_now.length_ms - (loop_mode == LOOP_ONE ? status_now.fade_ms : 0);
+        total_seconds = total_ms / 1000;
+    }
     
     int x_text = 20 + max_label_width + padding;
     int max_width = SCREEN_WIDTH - x_text - 10;
@@ -419,14 +639,20 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
         y += 30;
     }
     
-    if (!meta.artist.empty()) {
+    if (scope_view) {
+        int scope_h = SCREEN_HEIGHT - 150 - y;
+        draw_scope(20, y, SCREEN_WIDTH - 40, scope_h);
+        y += scope_h;
+    }
+
+    if (!scope_view && !meta.artist.empty()) {
         render_text("Artist:", 20, y, green);
         render_scrolling_text(meta.artist, x_text, y, max_width, orange, scroll_start_time_artist);
         y += 30;
     }
 
 
-    {
+    if (!scope_view) {
         int min = total_seconds / 60;
         int sec = total_seconds % 60;
         char formatted_length[16];
@@ -437,7 +663,7 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
         y += 30;
     }
 
-    {
+    if (!scope_view) {
         int min = elapsed / 60;
         int sec = elapsed % 60;
         char buf[16];
@@ -446,17 +672,17 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
         render_text(buf, 20 + max_label_width + padding, y, orange);
         y += 30;
     }
-    if (!meta.year.empty()) {
+    if (!scope_view && !meta.year.empty()) {
         render_text("Year:", 20, y, green);
         render_text(meta.year, 20 + max_label_width + padding, y, orange);
         y += 30;
     }
-    if (!meta.gsf_by.empty()) {
+    if (!scope_view && !meta.gsf_by.empty()) {
         render_text("GSF By:", 20, y, green);
         render_text(meta.gsf_by, 20 + max_label_width + padding, y, orange);
         y += 30;
     }
-    if (!meta.copyright.empty()) {
+    if (!scope_view && !meta.copyright.empty()) {
         render_text("Copyright:", 20, y, green);
         render_text(meta.copyright, 20 + max_label_width + padding, y, orange);
         y += 30;
@@ -474,7 +700,10 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
     SDL_RenderDrawRect(renderer, &border_rect);
 
     float progress = 0.0f;
-    if (total_seconds > 0) {
+    if (live && total_ms > 0) {
+        progress = (float)status_elapsed_ms() / total_ms;
+        if (progress > 1.0f) progress = 1.0f;
+    } else if (total_seconds > 0) {
         progress = (float)elapsed / total_seconds;
         if (progress > 1.0f) progress = 1.0f;
     }
@@ -520,7 +749,8 @@ void draw_playback(const TrackMetadata& meta, int elapsed) {
     render_text(looptxt, loop_value_x, y_pos, orange);
 
     render_text("B:Back L2/R2:Prev/Next Y:Loop Mode X:Bass Mode", 10, SCREEN_HEIGHT - 70, green);
-    render_text("ST:Pause  SL:exit  Menu:Lock", 10, SCREEN_HEIGHT - 40, green);
+    render_text("A:Scope", SCREEN_WIDTH - 110, SCREEN_HEIGHT - 40, green);
+    render_text("ST:Pause L1/R1:Seek SL:exit Menu:Lock", 10, SCREEN_HEIGHT - 40, green);
 
     render_status_monitor(SCREEN_WIDTH);
     SDL_RenderPresent(renderer);
@@ -548,22 +778,35 @@ int main() {
     int elapsed_seconds = 0;
 	
 	last_battery_update = SDL_GetTicks();
+	on_ac = read_on_ac();
+	scope_map = (const scope_block*)shared_open(scope_path, "scope", sizeof(scope_block));
+	status_map = (play_status*)shared_open(status_path, "status", sizeof(play_status));
+
+    // the player can go away with its control channel still open
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction chld{};
+    chld.sa_handler = on_child_exit;
+    chld.sa_flags = SA_NOCLDSTOP | SA_RESTART;
+    sigaction(SIGCHLD, &chld, nullptr);
+    signal(SIGTERM, on_quit);
 
     list_directory(current_path, true);
     
     {
         std::ifstream ifs(state_file_path());
         if (ifs) {
-            std::string last_path, last_name, last_type, last_bass;;
+            std::string last_path, last_name, last_type, last_bass, last_ms;
             std::getline(ifs, last_path);
             std::getline(ifs, last_name);
             std::getline(ifs, last_type);
             std::getline(ifs, last_bass);
+            std::getline(ifs, last_ms);
             
             if (!last_bass.empty())
                 bass_enabled_local = (last_bass == "1");
     
-            if (!last_path.empty() && is_directory(last_path)) {
+            if (!last_path.empty() && (is_directory(last_path) || is_archive(last_path))) {
                 current_path = last_path;
                 list_directory(current_path, true);
     
@@ -575,6 +818,16 @@ int main() {
                                 current_path += "/" + last_name;
                                 list_directory(current_path, true);
                             }
+                            // stopped while playing: on from there, as the player left it
+                            int resume_ms = last_ms.empty() ? -1 : atoi(last_ms.c_str());
+                            if (last_type == "FILE" && resume_ms >= 0) {
+                                std::string filepath = current_path + "/" + last_name;
+                                if (read_metadata(filepath, current_meta))
+                                    track_seconds = parse_length(current_meta.length);
+                                playback_start = clock_type::now() - std::chrono::milliseconds(resume_ms);
+                                launch_playgsf(filepath, resume_ms);
+                                mode = MODE_PLAYBACK; paused = false;
+                            }
                             break;
                         }
                     }
@@ -583,26 +836,37 @@ int main() {
         }
     }
     
-    draw_list();
+    if (mode == MODE_LIST) draw_list();
+    else draw_playback(current_meta, 0);
     bool running = true;
     SDL_Event e;
 
     while (running) {
         SDL_Delay(16);
+        if (quit_requested) running = false;
 
 		Uint32 now = SDL_GetTicks();
 		if (now - last_battery_update >= battery_update_interval) {
 		    int new_battery = read_battery_percent();
 		    if (new_battery >= 0) battery = new_battery;
+		    bool new_on_ac = read_on_ac();
+		    if (new_on_ac != on_ac) {
+		        on_ac = new_on_ac;
+		        char cmd[32];
+		        snprintf(cmd, sizeof(cmd), "interp %d", on_ac ? interp_ac : interp_battery);
+		        send_playgsf(cmd);
+		    }
 		    last_battery_update = now;
 		}
         
         // ---- CONTROL DEL FIN DE PISTA y CAMBIO CENTRALIZADO ----
-        if (playgsf_pid > 0 && !paused) {
+        if (playgsf_pid > 0 && !paused && child_exited) {
+            child_exited = 0;
             int status;
             pid_t ret = waitpid(playgsf_pid, &status, WNOHANG);
             if (ret == playgsf_pid) {
                 playgsf_pid = -1;
+                close_playgsf_ctl();
                 if (mode == MODE_PLAYBACK) {
                     if (manual_switch) {
                         int next_track = find_next_track(selected_index, manual_forward);
@@ -666,7 +930,18 @@ int main() {
         }
 
         // ------ CONTROL DE TIEMPO: MATAR PROCESO si termina -----
-        if (mode == MODE_PLAYBACK && playgsf_pid > 0 && !paused) {
+        if (mode == MODE_PLAYBACK && playgsf_pid > 0 && !paused && read_status()) {
+            // the player ends the track itself, fade and all, so only looping one track
+            // is cut short, where the fade would start
+            int elapsed_ms = status_elapsed_ms();
+            elapsed_seconds = elapsed_ms / 1000;
+            if (loop_mode == LOOP_ONE && track_seconds > 0 && status_now.length_ms > status_now.fade_ms &&
+                elapsed_ms >= (int)(status_now.length_ms - status_now.fade_ms)) {
+                manual_switch = false;
+                kill_playgsf();
+            }
+            draw_playback(current_meta, elapsed_seconds);
+        } else if (mode == MODE_PLAYBACK && playgsf_pid > 0 && !paused) {
             auto now = clock_type::now();
             elapsed_seconds = (int)std::chrono::duration_cast<std::chrono::seconds>(now - playback_start).count() - paused_seconds_total;
             int fade_sec = parse_length(current_meta.fade);
@@ -711,11 +986,13 @@ int main() {
                         FILE* f = fopen("/sys/class/backlight/backlight/bl_power", "w");
                         if (f) { fprintf(f, "1\n"); fclose(f); }
                         screen_off = true;
+                        if (scope_view) send_playgsf("scope 0");
                     } else {
                         system("wlr-randr --output DSI-1 --on");
                         FILE* f = fopen("/sys/class/backlight/backlight/bl_power", "w");
                         if (f) { fprintf(f, "0\n"); fclose(f); }
                         screen_off = false;
+                        if (scope_view) send_playgsf("scope 1");
                         if (mode == MODE_LIST) draw_list();
                         else draw_playback(current_meta, elapsed_seconds);
                     }
@@ -732,6 +1009,13 @@ int main() {
                             manual_switch = true; manual_forward = false; kill_playgsf(); break;
                         case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
                             manual_switch = true; manual_forward = true; kill_playgsf(); break;
+                        case SDL_CONTROLLER_BUTTON_LEFTSHOULDER:
+                            seek_by(-10000); break;
+                        case SDL_CONTROLLER_BUTTON_RIGHTSHOULDER:
+                            seek_by(10000); break;
+                        case SDL_CONTROLLER_BUTTON_A:
+                            scope_toggle();
+                            draw_playback(current_meta, elapsed_seconds); break;
                         case SDL_CONTROLLER_BUTTON_Y:
                             loop_mode = static_cast<LoopMode>((loop_mode + 1) % 3);
                             draw_playback(current_meta, elapsed_seconds); break;
@@ -741,8 +1025,9 @@ int main() {
                             draw_playback(current_meta, elapsed_seconds); break;
                         case SDL_CONTROLLER_BUTTON_START:
                             if (playgsf_pid > 0) {
-                                if (!paused) { kill(playgsf_pid, SIGSTOP); paused = true; paused_at = clock_type::now(); }
-                                else { kill(playgsf_pid, SIGCONT); paused = false; auto now_chrono = clock_type::now(); paused_seconds_total += std::chrono::duration_cast<std::chrono::seconds>(now_chrono - paused_at).count(); }
+                                // the player holds the device and sleeps, see pause_wait
+                                if (!paused) { send_playgsf("pause 1"); paused = true; paused_at = clock_type::now(); }
+                                else { send_playgsf("pause 0"); paused = false; auto now_chrono = clock_type::now(); paused_seconds_total += std::chrono::duration_cast<std::chrono::seconds>(now_chrono - paused_at).count(); }
                             }
                             draw_playback(current_meta, elapsed_seconds);
                             break;
@@ -806,7 +1091,18 @@ int main() {
         }
     }
 
-    kill_playgsf();
+    // where the track was, for the next start; the player keeps the rest, told so only
+    // here so that stopping it for the next track writes nothing
+    int resume_ms = -1;
+    if (mode == MODE_PLAYBACK && playgsf_pid > 0 && read_status())
+        resume_ms = status_elapsed_ms();
+    if (resume_ms >= 0) send_playgsf("keep");
+    // the player exits by itself once it has, or on SIGTERM if it couldn't be told
+    if (resume_ms < 0 || playgsf_ctl < 0) kill_playgsf();
+    close_playgsf_ctl();
+    if (playgsf_pid > 0) waitpid(playgsf_pid, nullptr, 0);
+    shared_close(scope_map, scope_path, sizeof(scope_block));
+    shared_close(status_map, status_path, sizeof(play_status));
     
     {
         std::ofstream ofs(state_file_path());
@@ -819,6 +1115,7 @@ int main() {
                 ofs << "\n\n";
             }
             ofs << (bass_enabled_local ? "1" : "0") << "\n";
+            ofs << resume_ms << "\n";
         }
     }
     